@@ -71,7 +71,7 @@ PYBIND11_MODULE(matlogger, m) {
                  py::arg("file"),
                  py::arg("opts") = MatLogger2::Options())
             .def("getFilename", &MatLogger2::get_filename)
-            .def("create", &MatLogger2::create,
+            .def("create", static_cast<bool (MatLogger2::*)(const std::string&, int, int, int)>(&MatLogger2::create),
                  py::arg("name"),
                  py::arg("rows"),
                  py::arg("cols") = 1,
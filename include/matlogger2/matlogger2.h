@@ -2,13 +2,18 @@
 #define __XBOT_MATLOGGER2_H__
 
 #include <string>
+#include <cstdint>
+#include <atomic>
 #include <memory>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <queue>
 #include <Eigen/Dense>
+#include <boost/utility/string_view.hpp>
 
 #include "matlogger2/utils/var_buffer.h"
+#include "matlogger2/utils/record_layout.h"
 #include "matlogger2/mat_data.h"
 
 #include "matlogger2/utils/visibility.h"
@@ -18,7 +23,10 @@ namespace XBot
     namespace matlogger2 
     {
         class MATL2_API Backend;
+        class MATL2_LOCAL FlushPipeline;
     }
+    
+    class MatAppender;
 
     /**
     * @brief The MatLogger2 class allows the user to save numeric variables
@@ -52,18 +60,21 @@ namespace XBot
     * (flush_available_data()). If the buffer becomes full, some data can go lost.
     * In producer-consumer mode, the MatLogger2 class can be used inside a 
     * multi-threaded environment, provided that the following constraints are satisfied:
-    *   1) only one "producer" thread shall call create() and add()
+    *   1) only one "producer" thread shall call create() and add(); additional
+    *      producer threads shall log through their own Lane (see make_lane())
     *   2) only one "consumer" thread shall call flush_available_data()
     * The MatAppender class (see matlogger2/utils/mat_appender.h) provides a 
     * ready-to-use consumer thread that periodically writes available data to disk.
     * 
-    * Circular-buffer single-threaded usage:
-    * Logged samples are pushed into a circular buffer. In circular-buffer mode,
-    * the user CAN NOT call flush_available_data(). 
-    * If the buffer becomes full, older samples are overwritten.
-    * In circular-buffer mode, the MatLogger2 class can NOT be used inside a 
-    * multi-threaded environment (i.e. additional synchronization must be provided
-    * by the user)
+    * Circular-buffer usage:
+    * Logged samples are pushed into a circular buffer. If the buffer becomes 
+    * full, older samples are overwritten. Data reaches the MAT-file on destruction,
+    * whereas flush_available_data() only writes captures requested by trigger().
+    * The same constraints as in producer-consumer mode apply (one producer 
+    * thread, and one consumer thread).
+    * 
+    * In both modes, any thread can read the most recent samples of a variable
+    * through snapshot(), without blocking the producer.
     */
     class MATL2_API MatLogger2
     {
@@ -75,6 +86,106 @@ namespace XBot
         typedef std::shared_ptr<MatLogger2> Ptr;
         typedef std::unique_ptr<MatLogger2> UniquePtr;
         
+        /**
+        * @brief The VariableName class is a non-owning reference to a variable
+        * name, together with its precomputed hash. It is implicitly constructible
+        * from std::string, C-strings and boost::string_view, so that name-based
+        * overloads never allocate a temporary std::string. Callers that keep
+        * name-based code inside a hot loop can construct a VariableName once, and
+        * reuse it to skip hashing the name on every call.
+        *
+        * NOTE: the referenced characters must outlive the VariableName object.
+        */
+        class MATL2_API VariableName
+        {
+            
+        public:
+            
+            VariableName(const char * name);
+            VariableName(const std::string& name);
+            VariableName(boost::string_view name);
+            
+            boost::string_view get_name() const;
+            std::size_t get_hash() const;
+            
+            /**
+            * @brief Hash function that is used to index variables by name
+            * (64-bit FNV-1a)
+            */
+            static std::size_t Hash(boost::string_view name);
+            
+        private:
+            
+            boost::string_view _name;
+            std::size_t _hash;
+        };
+        
+        /**
+        * @brief The VariableHandle class is a lightweight reference to a
+        * logged variable, which allows to add elements to it without any
+        * name lookup. A valid handle is obtained from create() or get_handle(),
+        * and it remains valid for the whole lifetime of the logger.
+        */
+        class MATL2_API VariableHandle
+        {
+            
+        public:
+            
+            /**
+            * @brief Default constructor creates an invalid handle
+            */
+            VariableHandle();
+            
+            bool is_valid() const;
+            explicit operator bool() const;
+            
+            /**
+            * @brief Name of the referenced variable (the handle must be valid)
+            */
+            const std::string& get_name() const;
+            
+        private:
+            
+            friend class MatLogger2;
+            
+            explicit VariableHandle(VariableBuffer * vbuf);
+            
+            VariableBuffer * _vbuf;
+        };
+        
+        /**
+        * @brief The RecordHandle class is a lightweight reference to a 
+        * record (see create_record()), which is used to add frames to it.
+        */
+        class MATL2_API RecordHandle
+        {
+            
+        public:
+            
+            /**
+            * @brief Default constructor creates an invalid handle
+            */
+            RecordHandle();
+            
+            bool is_valid() const;
+            explicit operator bool() const;
+            
+            /**
+            * @brief Layout of the referenced record (the handle must be valid)
+            */
+            const matlogger2::RecordLayout& get_layout() const;
+            
+        private:
+            
+            friend class MatLogger2;
+            
+            RecordHandle(VariableBuffer * vbuf, 
+                         const matlogger2::RecordLayout * layout);
+            
+            VariableBuffer * _vbuf;
+            const matlogger2::RecordLayout * _layout;
+        };
+        
         struct MATL2_API Options
         {
             bool enable_compression = false;
@@ -82,9 +193,139 @@ namespace XBot
             int default_buffer_size;
             int default_buffer_size_max_bytes;
             
+            // overflow policy of newly created variables (see set_overflow_policy())
+            VariableBuffer::OverflowPolicy default_overflow_policy;
+            
+            // number of blocks that make up the buffer of newly created variables
+            int default_num_blocks;
+            
+            // maximum time (in ms) that samples of newly created variables can
+            // wait inside a partially filled block, before being handed off to 
+            // the consumer (0 for no limit, i.e. blocks are handed off when full)
+            int default_max_block_age_ms;
+            
+            // allocate all blocks of newly created variables on creation, 
+            // instead of allocating them on demand from the consumer thread
+            // (which is only done if set_on_data_available_callback() was 
+            // called, e.g. by MatAppender::add_logger())
+            bool preallocate_blocks;
+            
+            // let the producer thread allocate a block when the consumer did 
+            // not allocate enough of them, instead of applying the overflow 
+            // policy (see VariableBuffer::set_producer_allocation())
+            bool producer_allocation;
+            
+            // number of threads that compress each write to the MAT-file
+            // (0 for compressing within the flushing thread); only used
+            // if enable_compression is set
+            int compression_threads;
+            
             Options();
         };
         
+        /**
+        * @brief Buffering options of a single variable (see create()).
+        * Fields that are left to -1 take the logger default value.
+        * 
+        * The buffer is made of num_blocks blocks, each holding block_size
+        * samples. Blocks are flushed to disk as a whole, so that larger blocks
+        * mean fewer (and larger) writes, whereas more blocks allow to absorb 
+        * longer stalls of the consumer.
+        */
+        struct MATL2_API VariableOptions
+        {
+            // number of samples that the buffer can hold 
+            // (defaults to Options::default_buffer_size)
+            int buffer_size;
+            
+            // number of blocks (defaults to Options::default_num_blocks)
+            int num_blocks;
+            
+            // number of samples inside a block (defaults to buffer_size/num_blocks,
+            // otherwise buffer_size is ignored)
+            int block_size;
+            
+            // maximum age in ms of a partially filled block, 0 for no limit 
+            // (defaults to Options::default_max_block_age_ms)
+            int max_block_age_ms;
+            
+            // reduce every reduction_factor samples to a single one before
+            // writing it to the buffer (see VariableBuffer::Reduction); the 
+            // default buffer size is divided by reduction_factor accordingly
+            VariableBuffer::Reduction reduction;
+            int reduction_factor;
+            
+            // only write samples that differ from the last written one by more 
+            // than deadband (0 for any change, negative to write all samples);
+            // the 1-based index of written samples is saved as '<name>_idx'
+            double deadband;
+            
+            VariableOptions();
+        };
+        
+        /**
+        * @brief The Lane class allows additional producer threads to log to the
+        * same MAT-file. Each producer thread obtains its own lane from make_lane().
+        * Variables that are created through a lane (or added to it by name) belong
+        * to the lane, and are found by name only through it; since every variable
+        * has its own queue, producers never share any state on the hot path. 
+        * The consumer flushes the variables of all lanes in flush_available_data().
+        * 
+        * A lane must be used by a single thread, and it must not outlive its logger.
+        */
+        class MATL2_API Lane
+        {
+            
+        public:
+            
+            typedef std::shared_ptr<Lane> Ptr;
+            
+            /**
+            * @brief Create a variable that belongs to this lane (see MatLogger2::create())
+            */
+            template <typename Scalar = double>
+            bool create(VariableHandle& handle,
+                        const std::string& var_name, 
+                        int rows, int cols = 1, 
+                        const VariableOptions& var_opt = VariableOptions());
+            
+            /**
+            * @brief Handle to a variable of this lane (invalid if not found)
+            */
+            VariableHandle get_handle(const VariableName& var_name) const;
+            
+            /**
+            * @brief Add an element to a variable of this lane, which is 
+            * created if it does not exist (see MatLogger2::add())
+            */
+            template <typename Derived>
+            bool add(const VariableName& var_name, const Eigen::MatrixBase<Derived>& data);
+            
+            bool add(const VariableName& var_name, double data);
+            
+            /**
+            * @brief Add an element through a handle (see MatLogger2::add())
+            */
+            template <typename Derived>
+            bool add(VariableHandle handle, const Eigen::MatrixBase<Derived>& data);
+            
+            bool add(VariableHandle handle, double data);
+            
+        private:
+            
+            friend class MatLogger2;
+            
+            explicit Lane(MatLogger2& logger);
+            
+            VariableBuffer * find_or_create(const VariableName& var_name,
+                                            int rows, int cols);
+            
+            MatLogger2& _logger;
+            
+            // index of the variables of this lane
+            std::unordered_multimap<std::size_t, VariableBuffer *> _index;
+        };
+        
         /**
         * @brief Factory method that must be used to construct a 
         * MatLogger2 instance.
@@ -107,20 +348,48 @@ namespace XBot
          */
         Options get_options() const;
         
+        /**
+        * @brief Returns the smallest maximum block age (in ms) among the 
+        * variables of this logger (see VariableOptions::max_block_age_ms), 
+        * or 0 if no variable has a maximum block age
+        */
+        int get_min_block_age() const;
+        
         /**
         * @brief Set the callback that is invoked whenever new data is available 
         * for writing to disk.
+        * Variables that are created while a callback is set only allocate a
+        * couple of blocks, and ask for more of them through the callback 
+        * (see VariableBuffer::preallocate()): the consumer is then expected 
+        * to call flush_available_data() soon. Otherwise, all blocks are 
+        * allocated on creation.
         */
         void set_on_data_available_callback(VariableBuffer::CallbackType callback);
         
         /**
         * @brief Set whether this buffer should be treated as a (possibly dual threaded) 
-        * producer-consumer queue, or as a single-threaded circular buffer.
+        * producer-consumer queue, or as a circular buffer that overwrites the oldest samples.
         * By default, the producer_consumer mode is used.
         * 
         * NOTE: only call this method before starting using the logger!
         */
         void set_buffer_mode(VariableBuffer::Mode buffer_mode);
+        
+        /**
+        * @brief Allocate all blocks of all existing variables. By default,
+        * only a couple of blocks per variable are allocated on creation, 
+        * and more blocks are allocated on demand by the consumer thread 
+        * (see also Options::preallocate_blocks).
+        * 
+        * Not to be called from the producer thread.
+        */
+        void preallocate();
+        
+        /**
+        * @brief Create a producer lane, which allows an additional thread to 
+        * log to this logger (see Lane). Not to be called from the producer thread.
+        */
+        Lane::Ptr make_lane();
     
         /**
         * @brief Create a logged variable from its name as it will appear 
@@ -138,6 +407,69 @@ namespace XBot
                     int rows, int cols = 1, 
                     int buffer_size = -1);
         
+        /**
+        * @brief Create a logged variable, and return a handle to it
+        * that can be used to add elements without any name lookup.
+        * 
+        * @param handle Handle to the created variable (invalid on failure)
+        * @return True on success (see create() above)
+        */
+        bool create(VariableHandle& handle, 
+                    const std::string& var_name, 
+                    int rows, int cols = 1, 
+                    int buffer_size = -1);
+        
+        /**
+        * @brief Create a logged variable whose samples are stored with the
+        * native type Scalar (e.g. float, int32_t, uint8_t, bool), both 
+        * in memory and inside the MAT-file. Added elements are casted to Scalar.
+        * By default (i.e. non-template overloads, and variables that are
+        * automatically created by add()), samples are stored as double.
+        * 
+        * Example: logger->create<std::int32_t>("encoder_counts", 6);
+        * 
+        * @return True on success (see create() above)
+        */
+        template <typename Scalar>
+        bool create(const std::string& var_name, 
+                    int rows, int cols = 1, 
+                    int buffer_size = -1);
+        
+        template <typename Scalar>
+        bool create(VariableHandle& handle, 
+                    const std::string& var_name, 
+                    int rows, int cols = 1, 
+                    int buffer_size = -1);
+        
+        /**
+        * @brief Create a logged variable with custom buffering options.
+        * 
+        * Example: 
+        *   MatLogger2::VariableOptions var_opt;
+        *   var_opt.num_blocks = 4;
+        *   var_opt.block_size = 1000;
+        *   logger->create(handle, "low_rate_var", 3, 1, var_opt);
+        * 
+        * @return True on success (variable name is unique, 
+        * dimensions and buffering options are valid)
+        */
+        bool create(VariableHandle& handle, 
+                    const std::string& var_name, 
+                    int rows, int cols, 
+                    const VariableOptions& var_opt);
+        
+        template <typename Scalar>
+        bool create(VariableHandle& handle, 
+                    const std::string& var_name, 
+                    int rows, int cols, 
+                    const VariableOptions& var_opt);
+        
+        /**
+        * @brief Returns a handle to an existing variable, or an invalid
+        * handle if no variable with the given name exists.
+        */
+        VariableHandle get_handle(const VariableName& var_name) const;
+        
         
         /**
         * @brief Add an element to an existing variable
@@ -145,18 +477,145 @@ namespace XBot
         */
         
         template <typename Derived>
-        bool add(const std::string& var_name, const Eigen::MatrixBase<Derived>& data);
+        bool add(const VariableName& var_name, const Eigen::MatrixBase<Derived>& data);
 
         bool add(const std::string& var_name, const Eigen::Affine3d& data);
         
         template <typename Scalar>
-        bool add(const std::string& var_name, const std::vector<Scalar>& data);
+        bool add(const VariableName& var_name, const std::vector<Scalar>& data);
         
         template <typename Iterator>
         // this overload may allocate a temporary vector!
-        bool add(const std::string& var_name, Iterator begin, Iterator end);
+        bool add(const VariableName& var_name, Iterator begin, Iterator end);
+        
+        bool add(const VariableName& var_name, double data);
+        
+        /**
+        * @brief Add an element to the variable referenced by the provided
+        * handle. These overloads never perform a name lookup.
+        * @return True on success (handle is valid, and dimensions match)
+        */
         
-        bool add(const std::string& var_name, double data);
+        template <typename Derived>
+        bool add(VariableHandle handle, const Eigen::MatrixBase<Derived>& data);
+        
+        template <typename Scalar>
+        bool add(VariableHandle handle, const std::vector<Scalar>& data);
+        
+        bool add(VariableHandle handle, double data);
+        
+        /**
+        * @brief Add a batch of elements at once, where each column of samples
+        * is an element. Matrix elements must be stored column-wise, i.e. 
+        * samples.rows() must equal rows*cols of the variable. Samples are 
+        * copied in bulk into the buffer. If the variable does not exist, a vector
+        * variable is created.
+        * 
+        * @return True on success (variable exists, and dimensions match)
+        */
+        template <typename Derived>
+        bool add_batch(const VariableName& var_name, const Eigen::MatrixBase<Derived>& samples);
+        
+        template <typename Derived>
+        bool add_batch(VariableHandle handle, const Eigen::MatrixBase<Derived>& samples);
+        
+        /**
+        * @brief Returns a view on the logger memory where the next element 
+        * of the variable will be stored, so that it can be computed in place, 
+        * without any copy. The element is added to the variable by calling
+        * commit(). No other element must be added to the same variable
+        * between reserve() and commit().
+        * 
+        * Example:
+        *   auto J = logger->reserve(jacobian_handle); // 6 x 40 view
+        *   compute_jacobian(J);
+        *   logger->commit(jacobian_handle);
+        * 
+        * @param Scalar Type of the variable (see create<Scalar>())
+        * @return A rows x cols view on the element, or an empty view (i.e.
+        * with data() == nullptr) if the handle is invalid, Scalar does not 
+        * match the variable type, or the element was dropped because the 
+        * buffer is full (drop_newest overflow policy)
+        */
+        template <typename Scalar = double>
+        Eigen::Map<Eigen::Matrix<Scalar, -1, -1>> reserve(VariableHandle handle);
+        
+        /**
+        * @brief Adds the element previously obtained from reserve() to the variable
+        * 
+        * @return True on success (handle is valid, and reserve() was called)
+        */
+        bool commit(VariableHandle handle);
+        
+        /**
+        * @brief Set what happens to new samples of a variable when its buffer
+        * is full, i.e. the consumer is not keeping up (producer-consumer mode 
+        * only). By default, Options::default_overflow_policy is used.
+        * 
+        * Only the producer thread is allowed to call this method.
+        * 
+        * @param policy See VariableBuffer::OverflowPolicy
+        * @param backpressure_timeout_us Maximum time that add() can wait 
+        * for the consumer (backpressure policy only)
+        * @return False if the handle is invalid
+        */
+        bool set_overflow_policy(VariableHandle handle,
+                                 VariableBuffer::OverflowPolicy policy,
+                                 int backpressure_timeout_us = 1000);
+        
+        /**
+        * @brief Returns the counters of the samples of a variable that were
+        * lost because its buffer was full (all zeros if the handle is invalid).
+        * It can be called from any thread.
+        */
+        VariableBuffer::DropStats get_drop_stats(VariableHandle handle) const;
+        
+        /**
+        * @brief Copy the most recent samples of a variable (up to max_samples,
+        * oldest first, one per column) without removing them from the buffer.
+        * It can be called from any thread (e.g. a monitoring thread), and never 
+        * blocks the producer (see VariableBuffer::snapshot()).
+        * 
+        * @return False if the handle is invalid, or if the producer kept 
+        * overwriting the requested samples while copying them
+        */
+        bool snapshot(VariableHandle handle, 
+                      Eigen::MatrixXd& data, 
+                      int max_samples) const;
+
+        /**
+        * @brief Create a record, i.e. a group of variables (fields) that are
+        * always logged together. A whole frame (one sample of each field) 
+        * is added with a single call to add_record(), and it is stored as one 
+        * contiguous element inside a single buffer. Fields are split into
+        * separate MAT-file variables (named after the fields) when flushing
+        * data to disk.
+        * 
+        * @param handle Output handle to the new record (invalid on failure)
+        * @param record_name Name of the record (it is not saved to disk, but 
+        * it must not clash with any other variable or record)
+        * @param layout Fields making up the record; field names must not 
+        * clash with any other variable
+        * @param buffer_size Number of frames that the buffer can hold
+        * @return True on success
+        */
+        bool create_record(RecordHandle& handle, 
+                           const std::string& record_name,
+                           const matlogger2::RecordLayout& layout, 
+                           int buffer_size = -1);
+        
+        /**
+        * @brief Add a frame to the record, by providing one value per field,
+        * in declaration order (either Eigen types or scalars). 
+        * 
+        * Example:
+        *   logger->add_record(handle, q, tau, counter);
+        * 
+        * @return True on success (handle is valid, number and size of
+        * fields are correct)
+        */
+        template <typename... Fields>
+        bool add_record(RecordHandle handle, const Fields&... fields);
 
         bool save(const std::string& var_name,
                   const matlogger2::MatData& var_data);
@@ -175,12 +634,52 @@ namespace XBot
         bool get_mat_var_names(std::vector<std::string>& var_names);
 
         /**
-        * @brief Flush available data to disk.
+        * @brief Flush available data to disk, draining the variables that
+        * are closest to overflowing first. Variables whose current block
+        * is older than their maximum block age (see VariableOptions) are 
+        * asked to hand off the block at their next add(), so that it is 
+        * flushed by the following call.
         * 
         * @return The number of bytes that were written to disk.
         */
         int flush_available_data();
         
+        /**
+        * @brief Flush available data to disk, stopping once about max_bytes
+        * have been written, or max_seconds have elapsed (a non-positive
+        * value means no limit). At least one block is written, if available.
+        * Variables are drained in order of urgency, i.e. the ones with the 
+        * least free space in their buffer first (see 
+        * BufferInfo::variable_free_space); ties are visited round-robin: 
+        * the next call resumes from the variable that follows the one where 
+        * this call stopped, so that all variables make progress under a 
+        * small budget.
+        * In circular buffer mode, triggered captures are written without limits.
+        * 
+        * @return The number of bytes that were written to disk.
+        */
+        int flush_available_data(int max_bytes, double max_seconds = 0);
+        
+        /**
+        * @brief Request a "black box" capture (circular buffer mode only): the
+        * samples that were logged from pre_seconds before this call, up to 
+        * post_seconds after it, are written to a separate MAT-file named 
+        * <file>_trigger_<n>.mat (n = 0, 1, ..). Logging continues
+        * uninterrupted in the meantime, and the samples that the capture
+        * takes out of the ring are written to the main file as well.
+        * 
+        * This method never blocks, and can be called from the producer thread
+        * (e.g. on a fault); the capture is written by flush_available_data() 
+        * (e.g. by a MatAppender flusher thread). The window is rounded to whole 
+        * blocks, and samples that do not reach the consumer within one second
+        * after the window closes are not captured.
+        * 
+        * @return False if not in circular buffer mode, or if the previous 
+        * request has not yet been taken over by the consumer (at most one 
+        * capture is written at a time)
+        */
+        bool trigger(double pre_seconds, double post_seconds);
+        
         /**
          * @brief Destructor flushes all buffers to disk, then releases
          * any resource connected with the underlying MAT-file
@@ -189,6 +688,8 @@ namespace XBot
         
     private:
         
+        friend class MatAppender;
+        
         /**
         * @brief Construct from path to mat-file, which is erased if already
         * existing.
@@ -199,6 +700,121 @@ namespace XBot
         MatLogger2(std::string file, 
                    Options opt = Options());
         
+        typedef std::unordered_multimap<std::size_t, VariableBuffer *> VariableIndex;
+        
+        /**
+        * @brief Implementation of the create() overloads; the new variable
+        * is indexed inside the given index (the logger's own one by default)
+        */
+        bool create_impl(const std::string& var_name, 
+                         int rows, int cols, 
+                         const VariableOptions& var_opt,
+                         matlogger2::ScalarType scalar_type,
+                         const matlogger2::RecordLayout * layout = nullptr,
+                         VariableIndex * index = nullptr);
+        
+        /**
+        * @brief Write a single field of a frame, checking its size
+        */
+        template <typename Derived>
+        static bool write_field(char * frame, 
+                                const matlogger2::RecordLayout::Field& field,
+                                const Eigen::MatrixBase<Derived>& data);
+        
+        template <typename Scalar>
+        static typename std::enable_if<std::is_arithmetic<Scalar>::value, bool>::type 
+        write_field(char * frame, 
+                    const matlogger2::RecordLayout::Field& field,
+                    Scalar data);
+        
+        /**
+        * @brief Consumer side of trigger(): write blocks that belong to 
+        * the capture window to the capture backend
+        * 
+        * @return Number of written bytes
+        */
+        int flush_trigger_capture();
+        
+        /**
+        * @brief Close the current capture file (if any)
+        */
+        void finish_trigger_capture();
+        
+        /**
+        * @brief Write valid_elems samples of a variable to the given backend,
+        * or queue them to the flush pipeline (if any)
+        * 
+        * @return Number of written (or queued) bytes
+        */
+        int write_block(matlogger2::Backend& backend,
+                        const char * var_name, 
+                        const char * data, 
+                        matlogger2::ScalarType scalar_type,
+                        std::pair<int, int> dims,
+                        int valid_elems);
+        
+        /**
+        * @brief Write a block of the given variable to the backend, together
+        * with its sample indices (if any)
+        * 
+        * @return Number of written bytes
+        */
+        int write_var_block(matlogger2::Backend& backend,
+                            const VariableBuffer& var,
+                            const matlogger2::RecordLayout * layout,
+                            const VariableBuffer::BlockView& block);
+        
+        /**
+        * @brief Write a block of the given variable to the backend. Blocks 
+        * that are followed by other queued blocks are gathered, and written 
+        * by a single call to flush_gathered() (or once enough data is gathered),
+        * so that the backend appends to each variable as few times as possible.
+        * 
+        * @return Number of written bytes
+        */
+        int append_block(matlogger2::Backend& backend,
+                         const VariableBuffer& var,
+                         const matlogger2::RecordLayout * layout,
+                         const VariableBuffer::BlockView& block);
+        
+        /**
+        * @brief Write all blocks that were gathered by append_block()
+        * 
+        * @return Number of written bytes
+        */
+        int flush_gathered(matlogger2::Backend& backend,
+                           const VariableBuffer& var,
+                           const matlogger2::RecordLayout * layout);
+        
+        /**
+        * @brief Split a block of record frames into its fields, and write 
+        * each of them to the backend
+        * 
+        * @return Number of written bytes
+        */
+        int write_record_block(matlogger2::Backend& backend,
+                               const matlogger2::RecordLayout& layout,
+                               const VariableBuffer::BlockView& block);
+        
+        /**
+        * @brief Let a separate writer thread perform backend writes 
+        * (see MatAppender::set_write_queue_size()), nullptr to write from
+        * the consumer thread
+        */
+        void set_flush_pipeline(std::shared_ptr<matlogger2::FlushPipeline> pipeline);
+        
+        /**
+        * @brief Set the function that is called by create() whenever 
+        * get_min_block_age() decreases, so that the consumer can check 
+        * partially filled blocks more often (see MatAppender)
+        */
+        void set_on_min_block_age_changed(std::function<void()> callback);
+        
+        /**
+        * @brief Wait for all writes that were queued to the flush pipeline
+        */
+        void drain_flush_pipeline();
+        
         /**
         * @brief Force all variables to write their current block into their queue 
         * 
@@ -210,10 +826,23 @@ namespace XBot
         * @brief Return a pointer to the requested variable. If it does 
         * not exist, it tries to create one with the provided dimentions.
         */
-        VariableBuffer * find_or_create(const std::string& var_name,
+        VariableBuffer * find_or_create(const VariableName& var_name,
                                         int rows, int cols
                                         );
         
+        /**
+        * @brief Return a pointer to the requested variable, or nullptr
+        * if it does not exist.
+        */
+        VariableBuffer * find(const VariableName& var_name) const;
+        
+        /**
+        * @brief Return a pointer to the requested variable inside the given 
+        * index, or nullptr if it is not found
+        */
+        static VariableBuffer * find(const VariableIndex& index, 
+                                     const VariableName& var_name);
+        
         
         // option struct
         Options _opt;
@@ -221,28 +850,76 @@ namespace XBot
         // protect non-const access to _vars
         // producer must hold it during create(), and 
         // set_on_data_available_callback()
-        // consumer must hold it during flush_available_data()
+        // the consumer never takes it, see _registry
         class MATL2_LOCAL MutexImpl;
         std::unique_ptr<MutexImpl> _vars_mutex;
         
         // map of all defined variables 
         std::unordered_map<std::string, VariableBuffer> _vars;
         
+        // names of all MAT-file variables that defined variables are saved 
+        // as (i.e. their own names, the fields of records, and the sample
+        // indices of variables with a deadband), which must be unique
+        std::unordered_set<std::string> _mat_names;
+        
+        // append-only list of all defined variables, which the consumer 
+        // iterates without locking (variables are published by create_impl()
+        // once fully initialized, and never removed); producers mark the 
+        // variables with pending blocks, so that flushes only visit those
+        class MATL2_LOCAL Registry;
+        std::unique_ptr<Registry> _registry;
+        
+        // index of all defined variables, keyed by VariableName::Hash(), so 
+        // that lookup does not require constructing a std::string
+        VariableIndex _vars_index;
+        
+        // layouts of all defined records, keyed by the record buffer
+        std::unordered_map<const VariableBuffer *, matlogger2::RecordLayout> _records;
+        
+        // consumer-side scratch buffer for splitting records into their fields
+        std::vector<char> _record_buffer;
+        
+        // consumer-side buffers for the samples (and their indices) of the 
+        // blocks that are gathered by append_block()
+        std::vector<char> _gather_buffer;
+        std::vector<std::int64_t> _gather_indices;
+        int _gather_samples;
+        
         // buffer mode
         VariableBuffer::Mode _buffer_mode;
         
         // callback that all variables shall use to notify that a new block is available 
         VariableBuffer::CallbackType _on_block_available;
         
+        // smallest maximum block age among variables (see get_min_block_age()),
+        // and function to be called when it decreases
+        std::atomic<int> _min_block_age_ms;
+        std::function<void()> _on_min_block_age_changed;
+        
         // path to mat-file
         std::string _file_name;
         
         // handle to backend object
         std::unique_ptr<matlogger2::Backend> _backend;
+        
+        // writer stage that backend writes are queued to (optional)
+        std::shared_ptr<matlogger2::FlushPipeline> _pipeline;
 
         std::unique_ptr<MutexImpl> _matdata_queue_mutex;
         std::queue<std::pair<std::string, matlogger2::MatData>> _matdata_queue;
         
+        // pending trigger() request (trigger time is zero if none is pending),
+        // written by trigger() and taken over by the consumer
+        std::atomic_flag _trigger_lock;
+        std::atomic<std::int64_t> _trigger_ns;
+        std::atomic<std::int64_t> _trigger_pre_ns;
+        std::atomic<std::int64_t> _trigger_post_ns;
+        
+        // capture that is being written by the consumer (if any)
+        class MATL2_LOCAL TriggerCapture;
+        std::unique_ptr<TriggerCapture> _capture;
+        int _capture_count;
+        
     };
     
 }
@@ -253,17 +930,301 @@ inline XBot::MatLogger2::Ptr XBot::MatLogger2::MakeLogger(Args... args)
     return Ptr(new MatLogger2(args...));
 }
         
+inline std::size_t XBot::MatLogger2::VariableName::Hash(boost::string_view name)
+{
+    // 64-bit FNV-1a
+    std::uint64_t hash = 14695981039346656037ULL;
+    
+    for(char c : name)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ULL;
+    }
+    
+    return static_cast<std::size_t>(hash);
+}
+
+inline XBot::MatLogger2::VariableName::VariableName(boost::string_view name):
+    _name(name),
+    _hash(Hash(name))
+{
+}
+
+inline XBot::MatLogger2::VariableName::VariableName(const char * name):
+    VariableName(boost::string_view(name))
+{
+}
+
+inline XBot::MatLogger2::VariableName::VariableName(const std::string& name):
+    VariableName(boost::string_view(name))
+{
+}
+
+inline boost::string_view XBot::MatLogger2::VariableName::get_name() const
+{
+    return _name;
+}
+
+inline std::size_t XBot::MatLogger2::VariableName::get_hash() const
+{
+    return _hash;
+}
+
+inline XBot::MatLogger2::VariableHandle::VariableHandle():
+    _vbuf(nullptr)
+{
+}
+
+inline XBot::MatLogger2::VariableHandle::VariableHandle(VariableBuffer * vbuf):
+    _vbuf(vbuf)
+{
+}
+
+inline bool XBot::MatLogger2::VariableHandle::is_valid() const
+{
+    return _vbuf != nullptr;
+}
+
+inline XBot::MatLogger2::VariableHandle::operator bool() const
+{
+    return is_valid();
+}
+
+inline const std::string& XBot::MatLogger2::VariableHandle::get_name() const
+{
+    return _vbuf->get_name();
+}
+        
+template <typename Scalar>
+inline bool XBot::MatLogger2::create(const std::string& var_name, 
+                                     int rows, int cols, 
+                                     int buffer_size)
+{
+    VariableOptions var_opt;
+    var_opt.buffer_size = buffer_size;
+    
+    return create_impl(var_name, rows, cols, var_opt, 
+                       matlogger2::ScalarTypeOf<Scalar>::value);
+}
+
+template <typename Scalar>
+inline bool XBot::MatLogger2::create(VariableHandle& handle,
+                                     const std::string& var_name, 
+                                     int rows, int cols, 
+                                     int buffer_size)
+{
+    bool ret = create<Scalar>(var_name, rows, cols, buffer_size);
+    
+    handle = ret ? get_handle(var_name) : VariableHandle();
+    
+    return ret;
+}
+
+template <typename Scalar>
+inline bool XBot::MatLogger2::create(VariableHandle& handle,
+                                     const std::string& var_name, 
+                                     int rows, int cols, 
+                                     const VariableOptions& var_opt)
+{
+    bool ret = create_impl(var_name, rows, cols, var_opt, 
+                           matlogger2::ScalarTypeOf<Scalar>::value);
+    
+    handle = ret ? get_handle(var_name) : VariableHandle();
+    
+    return ret;
+}
+
+template <typename Derived>
+inline bool XBot::MatLogger2::add(const VariableName& var_name, const Eigen::MatrixBase< Derived >& data)
+{
+    VariableBuffer * vbuf = find_or_create(var_name, data.rows(), data.cols());
+    
+    return vbuf && vbuf->add_elem(data);
+    
+}
+
 template <typename Derived>
-inline bool XBot::MatLogger2::add(const std::string& var_name, const Eigen::MatrixBase< Derived >& data)
+inline bool XBot::MatLogger2::add(VariableHandle handle, const Eigen::MatrixBase< Derived >& data)
+{
+    return handle._vbuf && handle._vbuf->add_elem(data);
+}
+
+template <typename Scalar>
+inline bool XBot::MatLogger2::Lane::create(VariableHandle& handle,
+                                           const std::string& var_name, 
+                                           int rows, int cols, 
+                                           const VariableOptions& var_opt)
+{
+    bool ret = _logger.create_impl(var_name, rows, cols, var_opt, 
+                                   matlogger2::ScalarTypeOf<Scalar>::value,
+                                   nullptr, &_index);
+    
+    handle = ret ? get_handle(var_name) : VariableHandle();
+    
+    return ret;
+}
+
+template <typename Derived>
+inline bool XBot::MatLogger2::Lane::add(const VariableName& var_name, const Eigen::MatrixBase<Derived>& data)
 {
     VariableBuffer * vbuf = find_or_create(var_name, data.rows(), data.cols());
     
     return vbuf && vbuf->add_elem(data);
+}
+
+template <typename Derived>
+inline bool XBot::MatLogger2::Lane::add(VariableHandle handle, const Eigen::MatrixBase<Derived>& data)
+{
+    return _logger.add(handle, data);
+}
+
+template <typename Scalar>
+inline bool XBot::MatLogger2::add(VariableHandle handle, const std::vector<Scalar>& data)
+{
+    Eigen::Map<const Eigen::Matrix<Scalar,-1,1>> map(data.data(), data.size());
+    return add(handle, map);
+}
+
+inline bool XBot::MatLogger2::add(VariableHandle handle, double data)
+{
+    return add(handle, Eigen::Matrix<double, 1, 1>(data));
+}
+
+template <typename Derived>
+inline bool XBot::MatLogger2::add_batch(const VariableName& var_name, const Eigen::MatrixBase<Derived>& samples)
+{
+    VariableBuffer * vbuf = find_or_create(var_name, samples.rows(), 1);
+    
+    return vbuf && vbuf->add_batch(samples);
+}
+
+template <typename Derived>
+inline bool XBot::MatLogger2::add_batch(VariableHandle handle, const Eigen::MatrixBase<Derived>& samples)
+{
+    return handle._vbuf && handle._vbuf->add_batch(samples);
+}
+
+template <typename Scalar>
+inline Eigen::Map<Eigen::Matrix<Scalar, -1, -1>> XBot::MatLogger2::reserve(VariableHandle handle)
+{
+    typedef Eigen::Map<Eigen::Matrix<Scalar, -1, -1>> MapType;
+    
+    if(!handle._vbuf || 
+        handle._vbuf->get_scalar_type() != matlogger2::ScalarTypeOf<Scalar>::value)
+    {
+        return MapType(nullptr, 0, 0);
+    }
+    
+    Scalar * elem = static_cast<Scalar *>(handle._vbuf->reserve_elem());
+    
+    if(!elem)
+    {
+        return MapType(nullptr, 0, 0);
+    }
+    
+    auto dims = handle._vbuf->get_dimension();
+    
+    return MapType(elem, dims.first, dims.second);
+}
+
+inline bool XBot::MatLogger2::commit(VariableHandle handle)
+{
+    return handle._vbuf && handle._vbuf->commit_elem();
+}
+
+inline XBot::MatLogger2::RecordHandle::RecordHandle():
+    RecordHandle(nullptr, nullptr)
+{
+}
+
+inline XBot::MatLogger2::RecordHandle::RecordHandle(VariableBuffer * vbuf, 
+                                                   const matlogger2::RecordLayout * layout):
+    _vbuf(vbuf),
+    _layout(layout)
+{
+}
+
+inline bool XBot::MatLogger2::RecordHandle::is_valid() const
+{
+    return _vbuf != nullptr;
+}
+
+inline XBot::MatLogger2::RecordHandle::operator bool() const
+{
+    return is_valid();
+}
+
+inline const XBot::matlogger2::RecordLayout& XBot::MatLogger2::RecordHandle::get_layout() const
+{
+    return *_layout;
+}
+
+template <typename Derived>
+inline bool XBot::MatLogger2::write_field(char * frame, 
+                                          const matlogger2::RecordLayout::Field& field,
+                                          const Eigen::MatrixBase<Derived>& data)
+{
+    if(data.size() != field.get_size())
+    {
+        fprintf(stderr, "Unable to add frame: size of field '%s' does not match (%d vs %d)\n",
+                field.name.c_str(), (int)data.size(), field.get_size());
+        
+        return false;
+    }
+    
+    VariableBuffer::write_sample(frame + field.offset, field.scalar_type, data);
+    
+    return true;
+}
+
+template <typename Scalar>
+inline typename std::enable_if<std::is_arithmetic<Scalar>::value, bool>::type 
+XBot::MatLogger2::write_field(char * frame, 
+                              const matlogger2::RecordLayout::Field& field,
+                              Scalar data)
+{
+    return write_field(frame, field, Eigen::Matrix<Scalar, 1, 1>(data));
+}
+
+template <typename... Fields>
+inline bool XBot::MatLogger2::add_record(RecordHandle handle, const Fields&... fields)
+{
+    if(!handle._vbuf)
+    {
+        return false;
+    }
+    
+    const auto& layout_fields = handle._layout->get_fields();
+    
+    if(sizeof...(Fields) != layout_fields.size())
+    {
+        fprintf(stderr, "Unable to add frame: wrong number of fields (%d vs %d)\n",
+                int(sizeof...(Fields)), int(layout_fields.size()));
+        
+        return false;
+    }
+    
+    // write all fields in place, and only commit the frame if all of them
+    // were valid
+    char * frame = static_cast<char *>(handle._vbuf->reserve_elem());
+    
+    // frame was dropped because the buffer is full
+    if(!frame)
+    {
+        return false;
+    }
+    
+    auto field_it = layout_fields.begin();
+    bool ok = true;
+    
+    using expand = int[];
+    (void)expand{0, (ok = ok && write_field(frame, *field_it++, fields), 0)...};
     
+    return ok && handle._vbuf->commit_elem();
 }
 
 template<typename Iterator> 
-inline bool XBot::MatLogger2::add(const std::string& var_name, Iterator begin, Iterator end)
+inline bool XBot::MatLogger2::add(const VariableName& var_name, Iterator begin, Iterator end)
 {
     static std::vector<double> tmp;
     tmp.clear();
@@ -275,7 +1236,7 @@ inline bool XBot::MatLogger2::add(const std::string& var_name, Iterator begin, I
 
 
 template <typename Scalar>
-inline bool XBot::MatLogger2::add(const std::string& var_name, const std::vector<Scalar>& data)
+inline bool XBot::MatLogger2::add(const VariableName& var_name, const std::vector<Scalar>& data)
 {
     Eigen::Map<const Eigen::Matrix<Scalar,-1,1>> map(data.data(), data.size());
     return add(var_name, map);
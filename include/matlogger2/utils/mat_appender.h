@@ -59,6 +59,47 @@ namespace XBot
          */
         void start_flush_thread();
         
+        /**
+         * @brief Make the flusher thread wake up at least every period_ms 
+         * milliseconds, even if no new data is notified. This is needed for
+         * partially filled blocks to be flushed within their maximum age
+         * (see MatLogger2::VariableOptions::max_block_age_ms).
+         * In any case, the flusher thread wakes up at least every half the 
+         * smallest maximum block age among the variables of registered 
+         * loggers (see MatLogger2::get_min_block_age()), including variables
+         * that are created later on.
+         * 
+         * @param period_ms Wake up period (0 to disable)
+         */
+        void set_wakeup_period(int period_ms);
+        
+        /**
+         * @brief Flush registered loggers from num_workers threads (the flusher
+         * thread included). Each logger is flushed by a single thread at a time,
+         * and idle threads take over the next logger. Calls to the backend are 
+         * serialized if the underlying library is not thread-safe (as is the 
+         * case for matio), so that only the remaining work (e.g. copying and 
+         * allocating blocks) is done in parallel.
+         * Must be called before start_flush_thread(); the default is 1.
+         * 
+         * @return False if the flusher thread is already running, or num_workers < 1
+         */
+        bool set_num_workers(int num_workers);
+        
+        /**
+         * @brief Perform writes to disk (including compression) from a dedicated 
+         * writer thread, so that they overlap with the flusher thread (and workers)
+         * draining blocks into staging buffers. The flusher thread waits for the 
+         * writer when more than max_queued_bytes are queued.
+         * Must be called before start_flush_thread(); applies to all registered
+         * loggers, and to those that are registered afterwards.
+         * 
+         * @param max_queued_bytes Size of the write queue (0, the default, to 
+         * write from the flusher thread)
+         * @return False if the flusher thread is already running, or max_queued_bytes < 0
+         */
+        bool set_write_queue_size(int max_queued_bytes);
+        
         /**
          * @brief Destructor will join with the flusher thread if it was spawned
          * by the user.
@@ -0,0 +1,87 @@
+#ifndef __XBOT_MATLOGGER2_RECORD_LAYOUT_H__
+#define __XBOT_MATLOGGER2_RECORD_LAYOUT_H__
+
+#include <string>
+#include <vector>
+
+#include "matlogger2/utils/scalar_type.h"
+#include "matlogger2/utils/visibility.h"
+
+namespace XBot { namespace matlogger2 {
+
+    /**
+    * @brief The RecordLayout class describes the fields that make up
+    * a record, i.e. a group of variables that are logged together with 
+    * a single call (see MatLogger2::create_record()).
+    * 
+    * Fields are packed into a contiguous frame, in declaration order. 
+    * Each field is aligned to the size of its scalar type, and the frame 
+    * size is padded to a multiple of 8 bytes.
+    * 
+    * Example:
+    *   RecordLayout layout;
+    *   layout.add_field("q", 7)
+    *         .add_field<float>("tau", 7)
+    *         .add_field<std::int32_t>("counter", 1);
+    */
+    class MATL2_API RecordLayout
+    {
+        
+    public:
+        
+        struct Field
+        {
+            std::string name;
+            int rows;
+            int cols;
+            ScalarType scalar_type;
+            
+            // offset in bytes w.r.t. the beginning of the frame
+            int offset;
+            
+            int get_size() const;
+            int get_size_bytes() const;
+        };
+        
+        RecordLayout();
+        
+        /**
+        * @brief Append a field to the layout. Throws std::invalid_argument
+        * on invalid dimensions, or if a field with the same name exists.
+        * 
+        * @param name Name of the MAT-file variable that the field is saved to
+        */
+        RecordLayout& add_field(const std::string& name, 
+                                int rows, int cols, 
+                                ScalarType scalar_type);
+        
+        template <typename Scalar = double>
+        RecordLayout& add_field(const std::string& name, 
+                                int rows, int cols = 1);
+        
+        const std::vector<Field>& get_fields() const;
+        
+        int get_num_fields() const;
+        
+        /**
+        * @brief Size in bytes of a whole frame
+        */
+        int get_size_bytes() const;
+        
+    private:
+        
+        std::vector<Field> _fields;
+        int _size_bytes;
+        
+    };
+    
+} }
+
+template <typename Scalar>
+inline XBot::matlogger2::RecordLayout& XBot::matlogger2::RecordLayout::add_field(const std::string& name, 
+                                                                              int rows, int cols)
+{
+    return add_field(name, rows, cols, ScalarTypeOf<Scalar>::value);
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef __XBOT_MATLOGGER2_SCALAR_TYPE_H__
+#define __XBOT_MATLOGGER2_SCALAR_TYPE_H__
+
+#include <cstdint>
+#include <type_traits>
+
+#include "matlogger2/utils/visibility.h"
+
+namespace XBot { namespace matlogger2 {
+
+    /**
+    * @brief Enum for specifying the scalar type that a logged variable
+    * is stored with, both inside the memory buffer and inside the MAT-file.
+    * Logical values are stored as one byte per element.
+    */
+    enum class ScalarType
+    {
+        Double,
+        Single,
+        Int8,
+        UInt8,
+        Int16,
+        UInt16,
+        Int32,
+        UInt32,
+        Int64,
+        UInt64,
+        Logical
+    };
+
+    /**
+    * @brief Empty tag type that carries the C++ type used to
+    * store elements of a given ScalarType
+    */
+    template <typename T>
+    struct ScalarTag
+    {
+        typedef T type;
+    };
+
+    /**
+    * @brief Size in bytes of a single element of the given type
+    */
+    MATL2_API int scalar_type_size(ScalarType type);
+
+    /**
+    * @brief Human-readable name of the given type (MATLAB class name)
+    */
+    MATL2_API const char * scalar_type_name(ScalarType type);
+
+    /**
+    * @brief Invoke the callable f with a ScalarTag<T>, where T is the
+    * C++ type that is used to store elements of the given type.
+    */
+    template <typename Func>
+    auto dispatch_scalar_type(ScalarType type, Func&& f) -> decltype(f(ScalarTag<double>()));
+
+    namespace detail
+    {
+        constexpr ScalarType integer_scalar_type(std::size_t size, bool is_signed)
+        {
+            return size == 1 ? (is_signed ? ScalarType::Int8  : ScalarType::UInt8)  :
+                   size == 2 ? (is_signed ? ScalarType::Int16 : ScalarType::UInt16) :
+                   size == 4 ? (is_signed ? ScalarType::Int32 : ScalarType::UInt32) :
+                               (is_signed ? ScalarType::Int64 : ScalarType::UInt64);
+        }
+    }
+
+    /**
+    * @brief Trait that maps a C++ arithmetic type to the ScalarType
+    * that preserves it (e.g. ScalarTypeOf<float>::value == ScalarType::Single)
+    */
+    template <typename Scalar, typename Enable = void>
+    struct ScalarTypeOf;
+
+    template <>
+    struct ScalarTypeOf<double>
+    {
+        static constexpr ScalarType value = ScalarType::Double;
+    };
+
+    template <>
+    struct ScalarTypeOf<float>
+    {
+        static constexpr ScalarType value = ScalarType::Single;
+    };
+
+    template <>
+    struct ScalarTypeOf<bool>
+    {
+        static constexpr ScalarType value = ScalarType::Logical;
+    };
+
+    template <typename Scalar>
+    struct ScalarTypeOf<Scalar,
+                        typename std::enable_if<std::is_integral<Scalar>::value &&
+                                                !std::is_same<Scalar, bool>::value>::type>
+    {
+        static constexpr ScalarType value = detail::integer_scalar_type(sizeof(Scalar),
+                                                                        std::is_signed<Scalar>::value);
+    };
+
+} }
+
+template <typename Func>
+inline auto XBot::matlogger2::dispatch_scalar_type(ScalarType type, Func&& f) -> decltype(f(ScalarTag<double>()))
+{
+    switch(type)
+    {
+        case ScalarType::Single:  return f(ScalarTag<float>());
+        case ScalarType::Int8:    return f(ScalarTag<std::int8_t>());
+        case ScalarType::UInt8:   return f(ScalarTag<std::uint8_t>());
+        case ScalarType::Int16:   return f(ScalarTag<std::int16_t>());
+        case ScalarType::UInt16:  return f(ScalarTag<std::uint16_t>());
+        case ScalarType::Int32:   return f(ScalarTag<std::int32_t>());
+        case ScalarType::UInt32:  return f(ScalarTag<std::uint32_t>());
+        case ScalarType::Int64:   return f(ScalarTag<std::int64_t>());
+        case ScalarType::UInt64:  return f(ScalarTag<std::uint64_t>());
+        case ScalarType::Logical: return f(ScalarTag<std::uint8_t>());
+        default:                  return f(ScalarTag<double>());
+    }
+}
+
+#endif
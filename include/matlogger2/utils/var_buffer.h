@@ -2,10 +2,17 @@
 #define __XBOT_MATLOGGER2_BUFFER_BLOCK__
 
 #include <string>
+#include <cstring>
+#include <cstdint>
 #include <memory>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <type_traits>
 
 #include <Eigen/Dense>
 
+#include "matlogger2/utils/scalar_type.h"
 #include "matlogger2/utils/visibility.h"
 
 namespace XBot 
@@ -16,20 +23,35 @@ namespace XBot
     * a single logged variable. This is an internal library component,
     * and it is not meant for direct use.
     * 
-    * The memory buffer is splitted into a fixed number of blocks, that make
-    * up a "pool" of available memory. When a block is full, it is pushed into
-    * a lockfree queue, so that it is available for the consumer thread.
-    * As soon as the block is consumed, it is returned back to the pool via 
-    * another lockfree queue.
+    * The memory buffer is splitted into a number of blocks (at most num_blocks,
+    * fixed on construction), that make up a "pool" of available memory. When a 
+    * block is full, it is pushed into a lockfree queue, so that it is available 
+    * for the consumer thread. As soon as the block is consumed, it is returned 
+    * back to the pool via another lockfree queue. Memory for all blocks is 
+    * reserved on construction, inside a single cache-aligned memory slab, but 
+    * only a few blocks are initialized: the others are allocated lazily by the
+    * consumer (see preallocate()) and handed to the producer via a third 
+    * lockfree queue. Blocks are exchanged by pointer (i.e. without any 
+    * reference counting).
     * 
-    * Apart from the lockfree queues, no other data is shared between add_elem()
-    * and read_block(). So, they can be called concurrently without further 
-    * synchronization.
+    * Apart from the lockfree queues, the data shared between add_elem() and
+    * read_block() is limited to:
+    *  - a spin lock on the read queue, since the producer may pop the oldest
+    *    block when the buffer is full (see OverflowPolicy::drop_oldest);
+    *  - atomic flags and counters, i.e. the block growth and handoff requests
+    *    (see set_max_block_age()), the pending flag (see set_pending_flag()),
+    *    the start time of the current block, and the drop statistics;
+    *  - the block generation counters and the handoff history, which
+    *    implement a seqlock-like protocol for snapshot().
+    * So, they can be called concurrently without further synchronization.
     * 
     * Because the lockfree queue is of the Single-Producer-Single-Consumer
     * type, a single thread is allowed to call add_elem and read_block,
     * concurrently.
     * 
+    * Samples are stored with the scalar type that was provided on construction
+    * (see matlogger2::ScalarType), i.e. added elements are casted to such type.
+    * 
     */
     class MATL2_API VariableBuffer
     {
@@ -46,10 +68,71 @@ namespace XBot
             // is responsible for keeping the buffer free                   
             producer_consumer,  
             
-            // circular buffer mode (single thread)
+            // circular buffer mode: the oldest blocks are overwritten;
+            // a consumer can still read blocks (e.g. for a triggered
+            // capture, see MatLogger2::trigger())
             circular_buffer    
         };
         
+        /**
+        * @brief Enum for specifying what happens when the producer fills
+        * a block, and the pool has no free blocks left (i.e. the consumer 
+        * is not keeping up). Only used in producer_consumer mode.
+        */
+        enum class OverflowPolicy
+        {
+            // discard the samples of the current block, and keep writing
+            // on it (default)
+            drop_current,
+            
+            // keep the current block, and discard new samples until 
+            // the consumer returns a block to the pool
+            drop_newest,
+            
+            // discard the oldest block that is waiting inside the queue,
+            // and reuse it
+            drop_oldest,
+            
+            // wait (spinning and yielding) for the consumer to return a block
+            // to the pool, up to a timeout; then, fall back to drop_current.
+            // Not suitable for real-time producers!
+            backpressure
+        };
+        
+        /**
+        * @brief Enum for specifying how consecutive samples are reduced 
+        * before being written to the buffer (see set_reduction())
+        */
+        enum class Reduction
+        {
+            // every sample is written (default)
+            none,
+            
+            // only the first of every N samples is written
+            decimate,
+            
+            // the element-wise average of every N samples is written
+            average,
+            
+            // the element-wise minimum of every N samples is written
+            min,
+            
+            // the element-wise maximum of every N samples is written
+            max
+        };
+        
+        /**
+        * @brief Counters of the data that was lost because the buffer was full
+        */
+        struct DropStats
+        {
+            // number of samples that were lost
+            std::uint64_t dropped_samples;
+            
+            // number of (possibly partially filled) blocks that were discarded
+            std::uint64_t dropped_blocks;
+        };
+        
         struct BufferInfo
         {
             // name of the variable that the new data refers to
@@ -64,6 +147,30 @@ namespace XBot
         
         typedef std::function<void(BufferInfo)> CallbackType;
         
+        /**
+        * @brief Read-only view on a block that has been lent to the 
+        * consumer (see acquire_block())
+        */
+        struct BlockView
+        {
+            // valid samples, stored column-wise with the native scalar type
+            const char * data;
+            
+            // number of valid samples
+            int valid_elements;
+            
+            // size of valid samples in bytes
+            int size_bytes;
+            
+            // time (steady clock, in ns) at which the producer handed 
+            // off the block
+            std::int64_t timestamp_ns;
+            
+            // index of each valid sample (see get_deadband()), or nullptr 
+            // if samples are not indexed
+            const std::int64_t * indices;
+        };
+        
         /**
         * @brief Constructor
         * 
@@ -71,10 +178,19 @@ namespace XBot
         * @param dim_rows Sample rows number
         * @param dim_cols Sample columns number
         * @param block_size Number of samples that make up a block
+        * @param scalar_type Scalar type that samples are stored with
+        * @param num_blocks Maximum number of blocks that make up the buffer (only
+        * a few of them are allocated on construction, see preallocate())
+        * @param deadband Only write samples that differ from the last written 
+        * one by more than deadband (in any element), see get_deadband(). 
+        * 0 writes any changed sample, negative disables change detection.
         */
         VariableBuffer(std::string name, 
                        int dim_rows, int dim_cols, 
-                       int block_size);
+                       int block_size,
+                       matlogger2::ScalarType scalar_type = matlogger2::ScalarType::Double,
+                       int num_blocks = NumBlocks(),
+                       double deadband = -1);
         
         /**
         * @brief Sets a callback that is used to notify that a new block
@@ -84,17 +200,135 @@ namespace XBot
         
         /**
         * @brief Set whether this buffer should be treated as a (possibly dual threaded) 
-        * producer-consumer queue, or as a single-threaded circular buffer.
+        * producer-consumer queue, or as a circular buffer that overwrites the oldest samples.
         * By default, the producer_consumer mode is used.
         * 
         * NOTE: only call this method before starting using the logger!!
         */
         void set_buffer_mode(VariableBuffer::Mode mode);
         
+        /**
+        * @brief Set the policy that is applied when the buffer is full.
+        * 
+        * Only the producer thread is allowed to call this method.
+        * 
+        * @param policy Overflow policy (see OverflowPolicy)
+        * @param backpressure_timeout_us Maximum time that the producer can
+        * wait inside add_elem() (backpressure policy only)
+        */
+        void set_overflow_policy(OverflowPolicy policy, 
+                                 int backpressure_timeout_us = 1000);
+        
+        OverflowPolicy get_overflow_policy() const;
+        
+        /**
+        * @brief Set the maximum age of the current block, i.e. the maximum 
+        * time since its first sample was added, before it is pushed into the 
+        * queue even if it is only partially filled. This bounds the time that 
+        * samples of slow variables take to reach the consumer. 
+        * The age is checked by the consumer (see request_handoff_if_stale()), 
+        * and the block is pushed by the producer at the following add_elem().
+        * 
+        * NOTE: only call this method before starting using the logger!!
+        * 
+        * @param max_block_age_ms Maximum age in milliseconds (0 disables the check)
+        */
+        void set_max_block_age(int max_block_age_ms);
+        
+        int get_max_block_age() const;
+        
+        /**
+        * @brief Reduce every factor consecutive samples to a single one, 
+        * which is the only one that is written to the buffer. Averages, 
+        * minima and maxima are computed in double precision, and then
+        * cast to the stored type.
+        * 
+        * NOTE: only call this method before starting using the logger!!
+        * 
+        * @param reduction Reduction mode (see Reduction)
+        * @param factor Number of samples that are reduced to one (>= 1)
+        */
+        void set_reduction(Reduction reduction, int factor);
+        
+        Reduction get_reduction() const;
+        
+        int get_reduction_factor() const;
+        
+        /**
+        * @brief Change detection threshold, which is fixed on construction 
+        * (negative if disabled). Only samples that differ from the last 
+        * written one by more than the deadband (in any element) are written, 
+        * each together with its index, i.e. its 1-based position among all 
+        * added samples (after reduction, if any), see BlockView::indices.
+        */
+        double get_deadband() const;
+        
+        /**
+        * @brief If the current block is older than get_max_block_age(), ask 
+        * the producer to push it into the queue at the following add_elem(),
+        * by means of a lockfree flag.
+        * 
+        * Only the consumer thread is allowed to call this method.
+        * 
+        * @param now Current time
+        * @return True if a handoff was requested
+        */
+        bool request_handoff_if_stale(std::chrono::steady_clock::time_point now);
+        
+        /**
+        * @brief Returns the drop counters. It can be called from any thread.
+        */
+        DropStats get_drop_stats() const;
+        
         const std::string& get_name() const;
         
         std::pair<int, int> get_dimension() const;
         
+        matlogger2::ScalarType get_scalar_type() const;
+        
+        /**
+        * @brief Maximum number of blocks that make up the buffer
+        */
+        int get_num_blocks() const;
+        
+        /**
+        * @brief Number of blocks that have been allocated so far
+        */
+        int get_num_allocated_blocks() const;
+        
+        /**
+        * @brief Allocate blocks up to the given number (all blocks by default).
+        * Blocks are otherwise allocated on demand: the producer asks for more
+        * blocks when half of the allocated ones are in use, hinting that the
+        * buffer is full (see BufferInfo::variable_free_space) so that the 
+        * consumer wakes up, and the consumer allocates them inside 
+        * acquire_block(). So, allocations do not happen inside the producer 
+        * thread (unless enabled by set_producer_allocation()).
+        * 
+        * Not to be called from the producer thread (unless in circular buffer 
+        * mode, which preallocates all blocks anyway).
+        * 
+        * @param num_blocks Number of blocks that should be allocated (-1 for all)
+        */
+        void preallocate(int num_blocks = -1);
+        
+        /**
+        * @brief Allow the producer to allocate one block when none is 
+        * available, because the consumer did not keep up with its requests.
+        * This avoids dropping samples, at the price of an allocation inside 
+        * add_elem(). Disabled by default, so that the overflow policy applies.
+        * 
+        * NOTE: only call this method before starting using the logger!!
+        */
+        void set_producer_allocation(bool enabled);
+        
+        bool get_producer_allocation() const;
+        
+        /**
+        * @brief Number of samples that make up a block
+        */
+        int get_block_size() const;
+        
         /**
         * @brief Add an element to the buffer. If there is no space inside the 
         * current block, this is pushed into the queue by calling flush_to_queue().
@@ -109,6 +343,43 @@ namespace XBot
         template <typename Derived>
         bool add_elem(const Eigen::MatrixBase<Derived>& data);
         
+        /**
+        * @brief Add a batch of elements to the buffer, where each column of 
+        * samples is an element (stored column-wise, i.e. samples.rows() must 
+        * be equal to rows*cols). Samples are copied in bulk into the current 
+        * block; whenever it fills up, it is pushed into the queue by calling
+        * flush_to_queue().
+        * 
+        * Only a single producer thread is allowed to concurrently call this
+        * method.
+        * 
+        * @return False if the number of rows does not match
+        */
+        template <typename Derived>
+        bool add_batch(const Eigen::MatrixBase<Derived>& samples);
+        
+        /**
+        * @brief Returns a pointer to the memory of the next free element of 
+        * the current block, so that the producer can directly write a sample
+        * into it (column-wise, with type get_scalar_type()). If the current 
+        * block is full, it is pushed into the queue by calling flush_to_queue().
+        * The sample becomes valid only after calling commit_elem(). Calling 
+        * reserve_elem() again before commit_elem() returns the same memory.
+        * If the sample is dropped because of the overflow policy, nullptr 
+        * is returned.
+        * 
+        * Only a single producer thread is allowed to concurrently call this
+        * method.
+        */
+        void * reserve_elem();
+        
+        /**
+        * @brief Marks the element returned by reserve_elem() as valid
+        * 
+        * @return False if no element was reserved
+        */
+        bool commit_elem();
+        
         /**
         * @brief Reads a whole block from the queue, if one is available.
         * The block is then returned to the pool.
@@ -116,7 +387,8 @@ namespace XBot
         * Only a single consumer thread is allowed to concurrently call this 
         * method.
         * 
-        * @param data Matrix which is filled with the read block (unless the function returns false)
+        * @param data Matrix which is filled with the read block (unless the function returns false),
+        * casted to double
         * @param valid_elements Number of valid elements contained in the block. This means that only 
         * data.leftCols(valid_elements) contains valid data.
         * @return True if valid_elements > 0
@@ -124,6 +396,62 @@ namespace XBot
         bool read_block(Eigen::MatrixXd& data, 
                         int& valid_elements);
         
+        /**
+        * @brief Reads a whole block from the queue, if one is available, without
+        * converting it from its native scalar type (see get_scalar_type()).
+        * The block is then returned to the pool.
+        * 
+        * @param data Raw memory which is filled with the valid elements of the read block,
+        * stored column-wise
+        * @param valid_elements Number of valid elements contained in the block
+        * @return True if valid_elements > 0
+        */
+        bool read_block(std::vector<char>& data, 
+                        int& valid_elements);
+        
+        /**
+        * @brief Lends the oldest block inside the queue to the consumer, 
+        * without copying it. The block is returned to the pool only when 
+        * release_block() is called, so that the view stays valid until then.
+        * Only one block can be lent at a time. Also allocates new blocks if
+        * requested by the producer (see preallocate()).
+        * 
+        * Only a single consumer thread is allowed to concurrently call this 
+        * method.
+        * 
+        * @param view View on the lent block (unless the function returns false)
+        * @return True if a block was available
+        */
+        bool acquire_block(BlockView& view);
+        
+        /**
+        * @brief Returns the block that was lent by acquire_block() to the pool
+        */
+        void release_block();
+        
+        /**
+        * @brief Number of blocks that are waiting to be read by the consumer
+        * (not including a block that is currently lent). Consumer side only.
+        */
+        int get_num_queued_blocks() const;
+        
+        /**
+        * @brief Copy the most recent samples (up to max_samples) into data, 
+        * oldest first, one sample per column, casting them to double. 
+        * The buffer is not modified, and the producer is never blocked: if 
+        * the producer overwrites the samples while they are being copied, 
+        * the copy is retried a few times.
+        * 
+        * This method can be called by any number of threads, concurrently 
+        * with the producer and consumer. In producer-consumer mode, samples 
+        * that were already flushed are not available.
+        * 
+        * @param data Output samples (rows*cols x n, with n <= max_samples)
+        * @param max_samples Maximum number of samples
+        * @return False if no consistent copy could be taken (data is then empty)
+        */
+        bool snapshot(Eigen::MatrixXd& data, int max_samples) const;
+        
         /**
         * @brief Writes current block to the queue. If a callback was registered through
         * set_on_block_available(), it is called on success.
@@ -132,12 +460,81 @@ namespace XBot
         */
         bool flush_to_queue();
         
+        /**
+        * @brief Set the bits of mask inside word whenever a block is pushed 
+        * into the queue, so that the consumer can find the variables with 
+        * pending blocks without visiting all of them (the consumer is in 
+        * charge of clearing the bits).
+        * 
+        * NOTE: only call this method before starting using the logger!!
+        */
+        void set_pending_flag(std::atomic<std::uint64_t> * word, std::uint64_t mask);
+        
+        /**
+        * @brief Default number of blocks that make up a buffer
+        */
         static int NumBlocks();
         
+        /**
+        * @brief Write data at the provided location, column-wise, casting 
+        * it to the given scalar type
+        */
+        template <typename Derived>
+        static void write_sample(char * dst, 
+                                 matlogger2::ScalarType scalar_type,
+                                 const Eigen::MatrixBase<Derived>& data);
+        
         ~VariableBuffer();
         
     private:
         
+        /**
+        * @brief Write a sample to the current block, making room if needed
+        */
+        template <typename Derived>
+        bool add_sample(const Eigen::MatrixBase<Derived>& data);
+        
+        /**
+        * @brief Accumulate a sample according to the reduction mode, and 
+        * write the reduced sample every get_reduction_factor() samples
+        */
+        template <typename Derived>
+        bool reduce_sample(const Eigen::MatrixBase<Derived>& data);
+        
+        /**
+        * @brief Producer side of the block age check: records the time of
+        * the first sample of the current block, and pushes the block into the
+        * queue if the consumer requested it
+        */
+        void check_block_age();
+        
+        /**
+        * @brief Push the current (full) block into the queue, and obtain an 
+        * empty one. If the pool is exhausted, the overflow policy is applied.
+        * 
+        * @param pending_samples Number of new samples that are waiting to be 
+        * written, which are counted as dropped on failure
+        * @return False if the current block could not be replaced (i.e. new 
+        * samples must be discarded)
+        */
+        bool make_room(int pending_samples);
+        
+        /**
+        * @brief Plain memory copy of src into dst, which is only performed
+        * if src is stored contiguously (column-wise) with type Scalar
+        * 
+        * @return True if the copy was performed
+        */
+        template <typename Scalar, typename Derived>
+        static bool copy_contiguous(Scalar * dst, 
+                                    const Eigen::MatrixBase<Derived>& src, 
+                                    std::true_type has_direct_access);
+        
+        template <typename Scalar, typename Derived>
+        static bool copy_contiguous(Scalar * dst, 
+                                    const Eigen::MatrixBase<Derived>& src, 
+                                    std::false_type has_direct_access);
+        
         /**
         * @brief The BufferBlock class represents a block of memory that
         * can hold block_size samples of a logged variable, stored
@@ -148,15 +545,25 @@ namespace XBot
             
         public:
             
-            typedef std::shared_ptr<BufferBlock> Ptr;
-            
             BufferBlock();
             
             /**
+            * @param buf memory for the block (get_size_bytes() bytes), which is
+            * not owned by the block
             * @param dim number of elements of the sample (rows*cols)
             * @param block_size number of samples that the block will hold
+            * @param scalar_type type that samples are stored with
+            * @param index_buf memory for the sample indices (block_size elements,
+            * not owned by the block), or nullptr if samples are not indexed
+            */
+            BufferBlock(char * buf, int dim, int block_size, matlogger2::ScalarType scalar_type,
+                        std::int64_t * index_buf = nullptr);
+            
+            /**
+            * @brief Move constructor (only used while the block is not shared
+            * with other threads)
             */
-            BufferBlock(int dim, int block_size);
+            BufferBlock(BufferBlock&& other);
             
             
             /**
@@ -169,6 +576,29 @@ namespace XBot
             template <typename Derived>
             bool add(const Eigen::MatrixBase<Derived>& data);
             
+            /**
+            * @brief Add as many samples as possible to the block (i.e. up to
+            * the number of free elements), starting from the first column
+            * 
+            * @param samples Samples to be added, one per column
+            * @return Number of samples that were written
+            */
+            template <typename Derived>
+            int add_batch(const Eigen::MatrixBase<Derived>& samples);
+            
+            
+            /**
+            * @brief Returns a pointer to the next free element, or nullptr 
+            * if the block is full
+            */
+            char * reserve();
+            
+            /**
+            * @brief Marks the next free element as valid
+            * 
+            * @return False if the block is full
+            */
+            bool commit();
             
             /**
             * @brief Reset the buffer to an empty condition.
@@ -176,11 +606,18 @@ namespace XBot
             void reset();
             
             /**
-            * @brief Returns a reference to the memory block. Note that the last
+            * @brief Returns a pointer to the memory block. Note that the last
             * columns may be invalid: only the first get_valid_elements() columns 
             * contain valid data.
             */
-            const Eigen::MatrixXd& get_data() const;
+            const char * get_data() const;
+            
+            /**
+            * @brief Returns a view on the memory block, which must be stored 
+            * with type Scalar
+            */
+            template <typename Scalar>
+            Eigen::Map<const Eigen::Matrix<Scalar, -1, -1>> get_data_as() const;
             
             
             /**
@@ -191,15 +628,59 @@ namespace XBot
             
             int get_size() const;
             int get_size_bytes() const;
+            int get_sample_size_bytes() const;
+            
+            /**
+            * @brief Indices of the samples (see get_deadband()), or nullptr
+            */
+            const std::int64_t * get_index_data() const;
+            
+            /**
+            * @brief Set the index of the last sample that was added
+            */
+            void set_last_index(std::int64_t index);
+            
+            /**
+            * @brief Number of times the block has been reset
+            */
+            std::uint32_t get_generation() const;
+            
+            /**
+            * @brief Time (steady clock, in ns) at which the block was pushed
+            * into the queue
+            */
+            std::int64_t get_timestamp_ns() const;
+            void set_timestamp_ns(std::int64_t timestamp_ns);
             
             
         private:
             
-            // current write index (also equals the number of valid elements)
-            int _write_idx; 
+            // current write index (also equals the number of valid elements),
+            // which can be read concurrently by snapshot()
+            std::atomic<int> _write_idx; 
+            
+            // incremented whenever the block is reset, so that concurrent 
+            // readers detect that its content was overwritten
+            std::atomic<std::uint32_t> _generation;
+            
+            // number of scalars inside a sample
+            int _dim;
+            
+            // number of samples inside the block
+            int _size;
+            
+            // type of the stored scalars, and its size in bytes
+            matlogger2::ScalarType _scalar_type;
+            int _scalar_size;
             
             // memory for get_size() elements, stored column-wise
-            Eigen::MatrixXd _buf;
+            char * _buf;
+            
+            // memory for get_size() sample indices (optional)
+            std::int64_t * _index_buf;
+            
+            // hand-off time
+            std::int64_t _timestamp_ns;
             
         };
         
@@ -213,8 +694,41 @@ namespace XBot
         int _rows;
         int _cols;
         
-        // current block
-        BufferBlock::Ptr _current_block;
+        // type that samples are stored with
+        matlogger2::ScalarType _scalar_type;
+        
+        // number of samples inside a block
+        int _block_size;
+        
+        // what to do when the buffer is full
+        OverflowPolicy _overflow_policy;
+        int _backpressure_timeout_us;
+        
+        // maximum age of current block (0 if disabled)
+        int _max_block_age_ms;
+        
+        // sample reduction (disabled if factor is 1): samples accumulated 
+        // so far, and their running sum/min/max
+        Reduction _reduction;
+        int _reduction_factor;
+        int _reduction_count;
+        Eigen::VectorXd _reduction_acc;
+        
+        // change detection (disabled if deadband is negative): number of 
+        // samples so far, and last written sample
+        double _deadband;
+        std::int64_t _sample_count;
+        Eigen::VectorXd _last_value;
+        
+        // memory returned by reserve_elem() when reduction or change
+        // detection is enabled
+        std::vector<char> _scratch_elem;
+        
+        // current block (owned by the queue)
+        BufferBlock * _current_block;
+        
+        // block that is lent to the consumer (consumer side only)
+        BufferBlock * _lent_block;
         
         // fifo spsc queue of blocks 
         class QueueImpl;
@@ -223,6 +737,11 @@ namespace XBot
         // function to be called when a block is pushed into the queue
         CallbackType _on_block_available;
         
+        // bits that are set when a block is pushed into the queue
+        // (see set_pending_flag())
+        std::atomic<std::uint64_t> * _pending_word;
+        std::uint64_t _pending_mask;
+        
     };
     
 
@@ -231,32 +750,136 @@ namespace XBot
 
 
 
+template <typename Scalar, typename Derived>
+inline bool XBot::VariableBuffer::copy_contiguous(Scalar * dst, 
+                                                 const Eigen::MatrixBase<Derived>& src, 
+                                                 std::true_type)
+{
+    if(!std::is_same<Scalar, typename Derived::Scalar>::value)
+    {
+        return false;
+    }
+    
+    // vectors must have unit stride, matrices must also be column-major
+    // without any gap between columns
+    const bool is_vector = src.rows() == 1 || src.cols() == 1;
+    
+    const bool is_contiguous = src.innerStride() == 1 && 
+        (is_vector || (!Derived::IsRowMajor && src.outerStride() == src.rows()));
+    
+    if(!is_contiguous)
+    {
+        return false;
+    }
+    
+    std::memcpy(dst, src.derived().data(), src.size()*sizeof(Scalar));
+    
+    return true;
+}
+
+template <typename Scalar, typename Derived>
+inline bool XBot::VariableBuffer::copy_contiguous(Scalar *, 
+                                                 const Eigen::MatrixBase<Derived>&, 
+                                                 std::false_type)
+{
+    return false;
+}
+
+template <typename Derived>
+inline void XBot::VariableBuffer::write_sample(char * dst, 
+                                               matlogger2::ScalarType scalar_type,
+                                               const Eigen::MatrixBase<Derived>& data)
+{
+    if(scalar_type == matlogger2::ScalarType::Logical)
+    {
+        // logical values are stored as one byte (0 or 1)
+        Eigen::Map<Eigen::Matrix<std::uint8_t, -1, -1>> elem_map(reinterpret_cast<std::uint8_t *>(dst),
+                                                                 data.rows(), data.cols());
+        
+        elem_map.array() = (data.array() != typename Derived::Scalar(0)).template cast<std::uint8_t>();
+        
+        return;
+    }
+    
+    matlogger2::dispatch_scalar_type(scalar_type, [&data, dst](auto tag)
+    {
+        typedef typename decltype(tag)::type Scalar;
+        
+        Scalar * dst_ptr = reinterpret_cast<Scalar *>(dst);
+        
+        // try a plain memory copy first
+        typedef std::integral_constant<bool, bool(Derived::Flags & Eigen::DirectAccessBit)> HasDirectAccess;
+        
+        if(copy_contiguous(dst_ptr, data, HasDirectAccess()))
+        {
+            return;
+        }
+        
+        // Eigen-view on the memory to be written
+        Eigen::Map<Eigen::Matrix<Scalar, -1, -1>> elem_map(dst_ptr, data.rows(), data.cols());
+        
+        // cast data to the stored type and write it
+        elem_map.noalias() = data.template cast<Scalar>();
+    });
+}
+
 template <typename Derived>
 inline bool XBot::VariableBuffer::BufferBlock::add(const Eigen::MatrixBase<Derived>& data)
 {
+    const int write_idx = _write_idx.load(std::memory_order_relaxed);
+    
     // check if the block is full, and return false
-    if(_write_idx == get_size())
+    if(write_idx == get_size())
     {
         return false;
     }
 
-    // pointer to the _write_idx-th element (column of _buf)
-    double * col_ptr = _buf.data() + _write_idx*_buf.rows();
+    // pointer to the write_idx-th element (column of _buf)
+    char * col_ptr = _buf + write_idx*_dim*_scalar_size;
     
-    // Eigen-view on the column to be written
-    Eigen::Map<Eigen::MatrixXd> elem_map(col_ptr, 
-                                         data.rows(), data.cols());
-    
-    // cast data do double and write it to the current element
-    elem_map.noalias() = data.template cast<double>();
+    // write data to the current element
+    write_sample(col_ptr, _scalar_type, data);
 
-    // increase _write_idx 
-    _write_idx++;
+    // increase _write_idx (publishing the sample to concurrent readers)
+    _write_idx.store(write_idx + 1, std::memory_order_release);
     
     // if the block is not full, return true
     return true;
 }
 
+template <typename Derived>
+inline int XBot::VariableBuffer::BufferBlock::add_batch(const Eigen::MatrixBase<Derived>& samples)
+{
+    const int write_idx = _write_idx.load(std::memory_order_relaxed);
+    
+    // number of samples that fit inside the block
+    const int n_samples = std::min<int>(samples.cols(), get_size() - write_idx);
+    
+    if(n_samples <= 0)
+    {
+        return 0;
+    }
+    
+    // pointer to the write_idx-th element (column of _buf)
+    char * col_ptr = _buf + write_idx*_dim*_scalar_size;
+    
+    // write all samples at once
+    write_sample(col_ptr, _scalar_type, samples.leftCols(n_samples));
+    
+    // increase _write_idx (publishing the samples to concurrent readers)
+    _write_idx.store(write_idx + n_samples, std::memory_order_release);
+    
+    return n_samples;
+}
+
+
+template <typename Scalar>
+inline Eigen::Map<const Eigen::Matrix<Scalar, -1, -1>> XBot::VariableBuffer::BufferBlock::get_data_as() const
+{
+    return Eigen::Map<const Eigen::Matrix<Scalar, -1, -1>>(reinterpret_cast<const Scalar *>(_buf),
+                                                          _dim, _size);
+}
+
 
 template <typename Derived>
 inline bool XBot::VariableBuffer::add_elem(const Eigen::MatrixBase<Derived>& data)
@@ -271,17 +894,161 @@ size does not match (%d vs %d)\n",
         return false;
     }
     
+    if(_reduction_factor > 1)
+    {
+        return reduce_sample(data);
+    }
+    
+    return add_sample(data);
+}
+
+template <typename Derived>
+inline bool XBot::VariableBuffer::add_sample(const Eigen::MatrixBase<Derived>& data)
+{
+    // skip samples that did not change
+    if(_deadband >= 0)
+    {
+        _sample_count++;
+        
+        Eigen::Map<Eigen::MatrixXd> last(_last_value.data(), data.rows(), data.cols());
+        
+        if(_sample_count > 1 &&
+            (data.template cast<double>() - last).cwiseAbs().maxCoeff() <= _deadband)
+        {
+            return true;
+        }
+    }
+    
     // if current block is full, we push it into the queue, and try again
-    if(!_current_block->add(data))
+    if(!_current_block->add(data) && 
+        !(make_room(1) && _current_block->add(data)))
+    {
+        return false;
+    }
+    
+    if(_deadband >= 0)
+    {
+        Eigen::Map<Eigen::MatrixXd> last(_last_value.data(), data.rows(), data.cols());
+        last = data.template cast<double>();
+        _current_block->set_last_index(_sample_count);
+    }
+    
+    if(_max_block_age_ms > 0)
     {
+        check_block_age();
+    }
+    
+    return true;
+}
+
+template <typename Derived>
+inline bool XBot::VariableBuffer::reduce_sample(const Eigen::MatrixBase<Derived>& data)
+{
+    // keep the first sample out of every _reduction_factor
+    if(_reduction == Reduction::decimate)
+    {
+        const bool keep = _reduction_count == 0;
         
-        // write current block to queue
-        flush_to_queue();
+        _reduction_count = (_reduction_count + 1) % _reduction_factor;
         
-        // reset current block
-        _current_block->reset();
+        return keep ? add_sample(data) : true;
+    }
+    
+    // accumulate the sample (with the same shape as data)
+    Eigen::Map<Eigen::MatrixXd> acc(_reduction_acc.data(), data.rows(), data.cols());
+    
+    if(_reduction_count == 0)
+    {
+        acc = data.template cast<double>();
+    }
+    else if(_reduction == Reduction::average)
+    {
+        acc += data.template cast<double>();
+    }
+    else if(_reduction == Reduction::min)
+    {
+        acc = acc.cwiseMin(data.template cast<double>());
+    }
+    else
+    {
+        acc = acc.cwiseMax(data.template cast<double>());
+    }
+    
+    if(++_reduction_count < _reduction_factor)
+    {
+        return true;
+    }
+    
+    // write the reduced sample
+    _reduction_count = 0;
+    
+    if(_reduction == Reduction::average)
+    {
+        acc /= _reduction_factor;
+    }
+    
+    return add_sample(acc);
+}
+
+template <typename Derived>
+inline bool XBot::VariableBuffer::add_batch(const Eigen::MatrixBase<Derived>& samples)
+{
+    // check data size correctness
+    if( samples.rows() != _rows*_cols )
+    {
+        fprintf(stderr, "Unable to add batch to variable '%s': \
+number of rows does not match (%d vs %d)\n",
+                _name.c_str(), (int)samples.rows(), _rows*_cols);
         
-        return add_elem(data);
+        return false;
+    }
+    
+    const int n_samples = samples.cols();
+    
+    // reduced samples are processed one by one
+    if(_reduction_factor > 1)
+    {
+        bool ret = true;
+        
+        for(int i = 0; i < n_samples; i++)
+        {
+            ret = reduce_sample(samples.col(i)) && ret;
+        }
+        
+        return ret;
+    }
+    
+    // so are samples subject to change detection
+    if(_deadband >= 0)
+    {
+        bool ret = true;
+        
+        for(int i = 0; i < n_samples; i++)
+        {
+            ret = add_sample(samples.col(i)) && ret;
+        }
+        
+        return ret;
+    }
+    
+    // fill the current block, and push it into the queue whenever it becomes
+    // full, until all samples have been written
+    int written = _current_block->add_batch(samples);
+    
+    while(written < n_samples)
+    {
+        // push current block to queue, and get an empty one
+        if(!make_room(n_samples - written))
+        {
+            return false;
+        }
+        
+        written += _current_block->add_batch(samples.rightCols(n_samples - written));
+    }
+    
+    if(_max_block_age_ms > 0)
+    {
+        check_block_age();
     }
     
     return true;
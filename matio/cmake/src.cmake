@@ -80,6 +80,10 @@ if(ZLIB_FOUND)
     target_link_libraries(${PROJECT_NAME} PUBLIC MATIO::ZLIB)
 endif()
 
+if(HAVE_PTHREAD)
+    target_link_libraries(${PROJECT_NAME} PUBLIC Threads::Threads)
+endif()
+
 set_target_properties(${PROJECT_NAME} PROPERTIES POSITION_INDEPENDENT_CODE ${MATIO_PIC})
 if(MATIO_SHARED)
     # Convert matio_LIB_VERSIONINFO libtool version format into VERSION and SOVERSION
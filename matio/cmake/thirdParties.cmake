@@ -102,3 +102,12 @@ if(MATIO_WITH_ZLIB)
         set(HAVE_ZLIB 1)
     endif()
 endif()
+
+if(HAVE_ZLIB AND MATIO_MAT73)
+    # Threads compressing appended chunks (see Mat_SetCompressionThreads)
+    set(THREADS_PREFER_PTHREAD_FLAG ON)
+    find_package(Threads)
+    if(CMAKE_USE_PTHREADS_INIT)
+        set(HAVE_PTHREAD 1)
+    endif()
+endif()
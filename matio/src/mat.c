@@ -508,6 +508,7 @@ Mat_Open(const char *matname, int mode)
     mat->num_datasets = 0;
 #if defined(MAT73) && MAT73
     mat->refs_id = -1;
+    mat->compression_threads = 0;
 #endif
     mat->dir = NULL;
 
@@ -858,6 +859,39 @@ Mat_Rewind(mat_t *mat)
     return err;
 }
 
+/** @brief Sets the number of threads compressing appended data
+ *
+ * Sets the number of threads used by Mat_VarWriteAppend to compress the
+ * chunks that are completely filled by the appended data. Such chunks are
+ * deflated in parallel and written with direct chunk writes, whereas the
+ * remaining data goes through the HDF5 filter pipeline as usual. The files
+ * are identical in format to the ones written without threads.
+ * Only version 7.3 MAT files are supported.
+ * @ingroup MAT
+ * @param mat Pointer to the MAT file
+ * @param num_threads Number of compression threads, 0 to disable
+ * @retval 0 on success
+ */
+int
+Mat_SetCompressionThreads(mat_t *mat, int num_threads)
+{
+    int err = MATIO_E_NO_ERROR;
+
+    if ( NULL == mat || num_threads < 0 )
+        return MATIO_E_BAD_ARGUMENT;
+
+#if defined(MAT73) && MAT73
+    if ( MAT_FT_MAT73 == mat->version )
+        mat->compression_threads = num_threads;
+    else
+        err = MATIO_E_OPERATION_NOT_SUPPORTED;
+#else
+    err = MATIO_E_OPERATION_NOT_SUPPORTED;
+#endif
+
+    return err;
+}
+
 /** @brief Returns the size of a Matlab Class
  *
  * Returns the size (in bytes) of the matlab class class_type
@@ -1394,6 +1428,9 @@ Mat_VarDelete(mat_t *mat, const char *name)
                             }
                             free(mat->dir);
                         }
+#if defined(MAT73) && MAT73
+                        tmp->compression_threads = mat->compression_threads;
+#endif
                         memcpy(mat, tmp, sizeof(mat_t));
                         free(tmp);
                         mat->num_datasets = n;
@@ -90,6 +90,7 @@ Mat_Create4(const char *matname)
     mat->num_datasets = 0;
 #if defined(MAT73) && MAT73
     mat->refs_id = -1;
+    mat->compression_threads = 0;
 #endif
     mat->dir = NULL;
 
@@ -660,6 +660,7 @@ Mat_Create5(const char *matname, const char *hdr_str)
     mat->num_datasets = 0;
 #if defined(MAT73) && MAT73
     mat->refs_id = -1;
+    mat->compression_threads = 0;
 #endif
     mat->dir = NULL;
 
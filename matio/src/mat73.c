@@ -38,6 +38,9 @@
 #include <stdio.h>
 #include <math.h>
 #include <time.h>
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #if defined(_MSC_VER) || defined(__MINGW32__)
 #define strdup _strdup
 #endif
@@ -87,6 +90,41 @@ struct ReadGroupInfoIterData
 #define MAX_RANK (3)
 #endif
 
+/* Full chunks of appended data can be compressed by several threads, and
+ * written with direct chunk writes (available since HDF5 1.10.3) */
+#if HAVE_ZLIB && HAVE_PTHREAD && H5_VERSION_GE(1, 10, 3)
+#define MAT73_DIRECT_CHUNK_WRITE 1
+
+struct Mat_H5Chunk
+{
+    hsize_t offset[MAX_RANK]; /* Offset of the chunk in the dataset */
+    void *buf;                /* Compressed chunk */
+    uLongf size;              /* Size of the compressed chunk */
+};
+
+struct Mat_H5ChunkJobs
+{
+    const char *data;           /* Appended data */
+    const hsize_t *dims;        /* Dimensions of the appended data */
+    const hsize_t *chunk_dims;  /* Dimensions of a chunk */
+    int rank;                   /* Rank of the dataset */
+    int append_index;           /* Dimension along which data is appended */
+    hsize_t append_offset;      /* Offset of the appended data in the dataset */
+    size_t elem_size;           /* Size of an element */
+    int level;                  /* Deflate level */
+    struct Mat_H5Chunk *chunks; /* Chunks to be compressed */
+    size_t num_chunks;          /* Number of chunks */
+    size_t stride;              /* Every stride-th chunk is compressed by the same thread */
+};
+
+struct Mat_H5ChunkThread
+{
+    struct Mat_H5ChunkJobs *jobs;
+    size_t first;
+    int err;
+};
+#endif
+
 /*===========================================================================
  *  Private functions
  *===========================================================================
@@ -110,11 +148,14 @@ static int Mat_VarWriteCell73(hid_t id, matvar_t *matvar, const char *name, hid_
                               hsize_t *dims);
 static int Mat_VarWriteChar73(hid_t id, matvar_t *matvar, const char *name, hsize_t *dims);
 static int Mat_WriteEmptyVariable73(hid_t id, const char *name, hsize_t rank, size_t *dims);
-static int Mat_VarWriteLogical73(hid_t id, matvar_t *matvar, const char *name, hsize_t *dims);
+static int Mat_VarWriteLogical73(hid_t id, matvar_t *matvar, const char *name, hsize_t *dims,
+                                 hsize_t *max_dims);
+static int Mat_VarWriteAppendLogical73(hid_t id, matvar_t *matvar, const char *name,
+                                       hsize_t *dims, int dim, int num_threads);
 static int Mat_VarWriteNumeric73(hid_t id, matvar_t *matvar, const char *name, hsize_t *dims,
                                  hsize_t *max_dims);
 static int Mat_VarWriteAppendNumeric73(hid_t id, matvar_t *matvar, const char *name, hsize_t *dims,
-                                       int dim);
+                                       int dim, int num_threads);
 static int Mat_VarWriteSparse73(hid_t id, matvar_t *matvar, const char *name);
 static int Mat_VarWriteStruct73(hid_t id, matvar_t *matvar, const char *name, hid_t *refs_id,
                                 hsize_t *dims, hsize_t *max_dims);
@@ -122,11 +163,11 @@ static int Mat_VarWriteAppendStruct73(hid_t id, matvar_t *matvar, const char *na
                                       hsize_t *dims, int dim);
 static int Mat_VarWriteNext73(hid_t id, matvar_t *matvar, const char *name, hid_t *refs_id);
 static int Mat_VarWriteAppendNext73(hid_t id, matvar_t *matvar, const char *name, hid_t *refs_id,
-                                    int dim);
+                                    int dim, int num_threads);
 static int Mat_VarWriteNextType73(hid_t id, matvar_t *matvar, const char *name, hid_t *refs_id,
                                   hsize_t *dims);
 static int Mat_VarWriteAppendNextType73(hid_t id, matvar_t *matvar, const char *name,
-                                        hid_t *refs_id, hsize_t *dims, int dim);
+                                        hid_t *refs_id, hsize_t *dims, int dim, int num_threads);
 static herr_t Mat_VarReadNextInfoIterate(hid_t id, const char *name, const H5L_info_t *info,
                                          void *op_data);
 static herr_t Mat_H5ReadGroupInfoIterate(hid_t dset_id, const char *name, const H5L_info_t *info,
@@ -135,9 +176,18 @@ static int Mat_H5ReadData(hid_t dset_id, hid_t h5_type, hid_t mem_space, hid_t d
                           int isComplex, void *data);
 static int Mat_H5WriteData(hid_t dset_id, hid_t h5_type, hid_t mem_space, hid_t dset_space,
                            int isComplex, void *data);
+static int Mat_H5WriteAppendRange(hid_t dset_id, hid_t space_id, hid_t h5_type, int rank,
+                                  const hsize_t *dims, int append_index, hsize_t append_offset,
+                                  hsize_t begin, hsize_t end, void *data);
+#if MAT73_DIRECT_CHUNK_WRITE
+static void *Mat_H5CompressChunks(void *arg);
+static int Mat_H5WriteAppendChunks(hid_t dset_id, hid_t h5_type, int rank, const hsize_t *dims,
+                                   int append_index, hsize_t append_offset, const void *data,
+                                   int num_threads, hsize_t *first, hsize_t *last);
+#endif
 static int Mat_H5WriteAppendData(hid_t id, hid_t h5_type, int mrank, const char *name,
                                  const size_t *mdims, hsize_t *dims, int dim, int isComplex,
-                                 void *data);
+                                 void *data, int num_threads);
 static int Mat_VarWriteRef(hid_t id, matvar_t *matvar, enum matio_compression compression,
                            hid_t *refs_id, hobj_ref_t *ref);
 
@@ -1328,9 +1378,309 @@ Mat_H5WriteData(hid_t dset_id, hid_t h5_type, hid_t mem_space, hid_t dset_space,
     return err;
 }
 
+/** @if mat_devman
+ * @brief Writes a range of the appended data along the append dimension
+ *
+ * @ingroup mat_internal
+ * @param dset_id HDF id of the (already extended) dataset
+ * @param space_id HDF id of the dataset space
+ * @param h5_type HDF type of the data
+ * @param rank rank of the dataset
+ * @param dims dimensions of the appended data
+ * @param append_index index of the dimension along which data is appended
+ * @param append_offset offset of the appended data in the dataset
+ * @param begin first index of the range
+ * @param end one past the last index of the range
+ * @param data appended data
+ * @retval 0 on success
+ * @endif
+ */
+static int
+Mat_H5WriteAppendRange(hid_t dset_id, hid_t space_id, hid_t h5_type, int rank, const hsize_t *dims,
+                       int append_index, hsize_t append_offset, hsize_t begin, hsize_t end,
+                       void *data)
+{
+    int err, k;
+    hsize_t mem_offset[MAX_RANK], dset_offset[MAX_RANK], count[MAX_RANK];
+    hid_t mspace_id;
+
+    if ( begin >= end )
+        return MATIO_E_NO_ERROR;
+    if ( rank > MAX_RANK )
+        return MATIO_E_BAD_ARGUMENT;
+
+    for ( k = 0; k < rank; k++ ) {
+        mem_offset[k] = 0;
+        dset_offset[k] = 0;
+        count[k] = dims[k];
+    }
+    mem_offset[append_index] = begin;
+    dset_offset[append_index] = append_offset + begin;
+    count[append_index] = end - begin;
+
+    mspace_id = H5Screate_simple(rank, dims, NULL);
+    H5Sselect_hyperslab(mspace_id, H5S_SELECT_SET, mem_offset, NULL, count, NULL);
+    H5Sselect_hyperslab(space_id, H5S_SELECT_SET, dset_offset, NULL, count, NULL);
+    err = Mat_H5WriteData(dset_id, h5_type, mspace_id, space_id, 0, data);
+    H5Sclose(mspace_id);
+
+    return err;
+}
+
+#if MAT73_DIRECT_CHUNK_WRITE
+/** @if mat_devman
+ * @brief Gathers and deflates the chunks assigned to a thread
+ *
+ * @ingroup mat_internal
+ * @param arg pointer to a Mat_H5ChunkThread
+ * @retval arg
+ * @endif
+ */
+static void *
+Mat_H5CompressChunks(void *arg)
+{
+    struct Mat_H5ChunkThread *thread = (struct Mat_H5ChunkThread *)arg;
+    const struct Mat_H5ChunkJobs *jobs = thread->jobs;
+    const int rank = jobs->rank;
+    const int last_dim = rank - 1;
+    hsize_t mem_strides[MAX_RANK], chunk_strides[MAX_RANK];
+    size_t chunk_bytes = jobs->elem_size;
+    size_t i;
+    int k;
+
+    /* Strides (in elements) of the appended data and of a chunk */
+    mem_strides[last_dim] = 1;
+    chunk_strides[last_dim] = 1;
+    for ( k = last_dim; k > 0; k-- ) {
+        mem_strides[k - 1] = mem_strides[k] * jobs->dims[k];
+        chunk_strides[k - 1] = chunk_strides[k] * jobs->chunk_dims[k];
+    }
+    for ( k = 0; k < rank; k++ ) {
+        chunk_bytes *= (size_t)jobs->chunk_dims[k];
+    }
+
+    for ( i = thread->first; i < jobs->num_chunks; i += jobs->stride ) {
+        struct Mat_H5Chunk *chunk = jobs->chunks + i;
+        hsize_t start[MAX_RANK], count[MAX_RANK], idx[MAX_RANK];
+        char *raw;
+        size_t run_bytes;
+
+        /* Edge chunks are padded with zeros */
+        raw = (char *)calloc(chunk_bytes, 1);
+        chunk->buf = malloc(compressBound((uLong)chunk_bytes));
+        if ( NULL == raw || NULL == chunk->buf ) {
+            free(raw);
+            thread->err = MATIO_E_OUT_OF_MEMORY;
+            break;
+        }
+
+        /* Part of the appended data covered by the chunk */
+        for ( k = 0; k < rank; k++ ) {
+            start[k] = chunk->offset[k];
+            if ( k == jobs->append_index )
+                start[k] -= jobs->append_offset;
+            count[k] = jobs->dims[k] - start[k];
+            if ( count[k] > jobs->chunk_dims[k] )
+                count[k] = jobs->chunk_dims[k];
+            idx[k] = 0;
+        }
+
+        /* Copy contiguous runs along the last dimension */
+        run_bytes = (size_t)count[last_dim] * jobs->elem_size;
+        for ( ;; ) {
+            hsize_t mem_pos = 0, chunk_pos = 0;
+            for ( k = 0; k < last_dim; k++ ) {
+                mem_pos += (start[k] + idx[k]) * mem_strides[k];
+                chunk_pos += idx[k] * chunk_strides[k];
+            }
+            mem_pos += start[last_dim];
+            memcpy(raw + chunk_pos * jobs->elem_size,
+                   jobs->data + mem_pos * jobs->elem_size, run_bytes);
+
+            for ( k = last_dim - 1; k >= 0; k-- ) {
+                if ( ++idx[k] < count[k] )
+                    break;
+                idx[k] = 0;
+            }
+            if ( k < 0 )
+                break;
+        }
+
+        chunk->size = compressBound((uLong)chunk_bytes);
+        if ( Z_OK != compress2((Bytef *)chunk->buf, &chunk->size, (const Bytef *)raw,
+                               (uLong)chunk_bytes, jobs->level) ) {
+            thread->err = MATIO_E_FILE_FORMAT_VIOLATION;
+        }
+        free(raw);
+        if ( thread->err )
+            break;
+    }
+
+    return arg;
+}
+
+/** @if mat_devman
+ * @brief Writes the chunks completely filled by appended data
+ *
+ * If the dataset is only deflate compressed, the chunks that are completely
+ * filled by the appended data are compressed by num_threads threads and
+ * written with direct chunk writes. The range [first, last) of the appended
+ * data along the append dimension that has been written is returned;
+ * the remaining data must be written as usual.
+ * @ingroup mat_internal
+ * @param dset_id HDF id of the (already extended) dataset
+ * @param h5_type HDF type of the data
+ * @param rank rank of the dataset
+ * @param dims dimensions of the appended data
+ * @param append_index index of the dimension along which data is appended
+ * @param append_offset offset of the appended data in the dataset
+ * @param data appended data
+ * @param num_threads number of compression threads
+ * @param[out] first first written index along the append dimension
+ * @param[out] last one past the last written index along the append dimension
+ * @retval 0 on success
+ * @endif
+ */
+static int
+Mat_H5WriteAppendChunks(hid_t dset_id, hid_t h5_type, int rank, const hsize_t *dims,
+                        int append_index, hsize_t append_offset, const void *data,
+                        int num_threads, hsize_t *first, hsize_t *last)
+{
+    int err = MATIO_E_NO_ERROR;
+    hid_t plist_id, file_type_id;
+    hsize_t chunk_dims[MAX_RANK], num_chunks[MAX_RANK];
+    hsize_t chunk_start, chunk_end;
+    unsigned int flags, cd_values[1] = {6};
+    size_t cd_nelmts = 1;
+    int level, same_type, k;
+    struct Mat_H5ChunkJobs jobs;
+    struct Mat_H5ChunkThread *threads;
+    pthread_t *thread_ids;
+    size_t i;
+
+    *first = 0;
+    *last = 0;
+
+    if ( rank < 1 || rank > MAX_RANK )
+        return MATIO_E_NO_ERROR;
+
+    /* Only datasets compressed with deflate alone are supported */
+    plist_id = H5Dget_create_plist(dset_id);
+    if ( H5D_CHUNKED != H5Pget_layout(plist_id) || 1 != H5Pget_nfilters(plist_id) ||
+         H5Z_FILTER_DEFLATE !=
+             H5Pget_filter2(plist_id, 0, &flags, &cd_nelmts, cd_values, 0, NULL, NULL) ||
+         rank != H5Pget_chunk(plist_id, rank, chunk_dims) ) {
+        H5Pclose(plist_id);
+        return MATIO_E_NO_ERROR;
+    }
+    H5Pclose(plist_id);
+    level = (int)cd_values[0];
+
+    /* Chunks are written as they are, no conversion must be needed */
+    file_type_id = H5Dget_type(dset_id);
+    same_type = H5Tequal(file_type_id, h5_type);
+    H5Tclose(file_type_id);
+    if ( same_type <= 0 )
+        return MATIO_E_NO_ERROR;
+
+    /* Chunks completely filled by the appended data */
+    chunk_start = (append_offset + chunk_dims[append_index] - 1) / chunk_dims[append_index];
+    chunk_end = (append_offset + dims[append_index]) / chunk_dims[append_index];
+    if ( chunk_start >= chunk_end )
+        return MATIO_E_NO_ERROR;
+
+    jobs.num_chunks = 1;
+    for ( k = 0; k < rank; k++ ) {
+        if ( k == append_index )
+            num_chunks[k] = chunk_end - chunk_start;
+        else
+            num_chunks[k] = (dims[k] + chunk_dims[k] - 1) / chunk_dims[k];
+        jobs.num_chunks *= (size_t)num_chunks[k];
+    }
+    if ( 0 == jobs.num_chunks )
+        return MATIO_E_NO_ERROR;
+
+    jobs.data = (const char *)data;
+    jobs.dims = dims;
+    jobs.chunk_dims = chunk_dims;
+    jobs.rank = rank;
+    jobs.append_index = append_index;
+    jobs.append_offset = append_offset;
+    jobs.elem_size = H5Tget_size(h5_type);
+    jobs.level = level;
+    jobs.stride = (size_t)num_threads < jobs.num_chunks ? (size_t)num_threads : jobs.num_chunks;
+    jobs.chunks = (struct Mat_H5Chunk *)calloc(jobs.num_chunks, sizeof(*jobs.chunks));
+    threads = (struct Mat_H5ChunkThread *)calloc(jobs.stride, sizeof(*threads));
+    thread_ids = (pthread_t *)calloc(jobs.stride, sizeof(*thread_ids));
+    if ( NULL == jobs.chunks || NULL == threads || NULL == thread_ids ) {
+        free(jobs.chunks);
+        free(threads);
+        free(thread_ids);
+        return MATIO_E_OUT_OF_MEMORY;
+    }
+
+    /* Chunk offsets in row-major order */
+    for ( i = 0; i < jobs.num_chunks; i++ ) {
+        size_t n = i;
+        for ( k = rank - 1; k >= 0; k-- ) {
+            hsize_t c = n % num_chunks[k];
+            n /= (size_t)num_chunks[k];
+            if ( k == append_index )
+                c += chunk_start;
+            jobs.chunks[i].offset[k] = c * chunk_dims[k];
+        }
+    }
+
+    /* The calling thread compresses its share as well; threads that cannot be
+     * spawned have their share compressed by the calling thread afterwards */
+    for ( i = 0; i < jobs.stride; i++ ) {
+        threads[i].jobs = &jobs;
+        threads[i].first = i;
+        threads[i].err = MATIO_E_NO_ERROR;
+    }
+    for ( i = 1; i < jobs.stride; i++ ) {
+        if ( 0 != pthread_create(thread_ids + i, NULL, Mat_H5CompressChunks, threads + i) )
+            threads[i].jobs = NULL;
+    }
+    Mat_H5CompressChunks(threads);
+    for ( i = 1; i < jobs.stride; i++ ) {
+        if ( NULL != threads[i].jobs ) {
+            pthread_join(thread_ids[i], NULL);
+        } else {
+            threads[i].jobs = &jobs;
+            Mat_H5CompressChunks(threads + i);
+        }
+    }
+    for ( i = 0; i < jobs.stride; i++ ) {
+        if ( threads[i].err )
+            err = threads[i].err;
+    }
+
+    /* HDF5 calls are made by the calling thread only */
+    for ( i = 0; i < jobs.num_chunks; i++ ) {
+        if ( MATIO_E_NO_ERROR == err &&
+             0 > H5Dwrite_chunk(dset_id, H5P_DEFAULT, 0, jobs.chunks[i].offset,
+                                (size_t)jobs.chunks[i].size, jobs.chunks[i].buf) ) {
+            err = MATIO_E_GENERIC_WRITE_ERROR;
+        }
+        free(jobs.chunks[i].buf);
+    }
+    free(jobs.chunks);
+    free(threads);
+    free(thread_ids);
+
+    if ( MATIO_E_NO_ERROR == err ) {
+        *first = chunk_start * chunk_dims[append_index] - append_offset;
+        *last = chunk_end * chunk_dims[append_index] - append_offset;
+    }
+
+    return err;
+}
+#endif
+
 static int
 Mat_H5WriteAppendData(hid_t id, hid_t h5_type, int mrank, const char *name, const size_t *mdims,
-                      hsize_t *dims, int dim, int isComplex, void *data)
+                      hsize_t *dims, int dim, int isComplex, void *data, int num_threads)
 {
     int err = MATIO_E_NO_ERROR;
     hid_t dset_id, space_id;
@@ -1346,7 +1696,7 @@ Mat_H5WriteAppendData(hid_t id, hid_t h5_type, int mrank, const char *name, cons
         hsize_t *size_offset_dims;
         size_offset_dims = (hsize_t *)malloc(rank * sizeof(*size_offset_dims));
         if ( NULL != size_offset_dims ) {
-            hsize_t offset;
+            hsize_t offset, first = 0, last = 0;
             hid_t mspace_id;
             int k;
 
@@ -1361,11 +1711,25 @@ Mat_H5WriteAppendData(hid_t id, hid_t h5_type, int mrank, const char *name, cons
             /* Need to reopen */
             H5Sclose(space_id);
             space_id = H5Dget_space(dset_id);
-            H5Sselect_hyperslab(space_id, H5S_SELECT_SET, size_offset_dims, NULL, dims, NULL);
+#if MAT73_DIRECT_CHUNK_WRITE
+            if ( num_threads > 0 && !isComplex )
+                err = Mat_H5WriteAppendChunks(dset_id, h5_type, rank, dims, rank - dim, offset,
+                                              data, num_threads, &first, &last);
+#endif
+            if ( MATIO_E_NO_ERROR == err && first < last ) {
+                /* Write the partial chunks before and after the full ones */
+                err = Mat_H5WriteAppendRange(dset_id, space_id, h5_type, rank, dims, rank - dim,
+                                             offset, 0, first, data);
+                if ( MATIO_E_NO_ERROR == err )
+                    err = Mat_H5WriteAppendRange(dset_id, space_id, h5_type, rank, dims,
+                                                 rank - dim, offset, last, dims[rank - dim], data);
+            } else if ( MATIO_E_NO_ERROR == err ) {
+                H5Sselect_hyperslab(space_id, H5S_SELECT_SET, size_offset_dims, NULL, dims, NULL);
+                mspace_id = H5Screate_simple(rank, dims, NULL);
+                err = Mat_H5WriteData(dset_id, h5_type, mspace_id, space_id, isComplex, data);
+                H5Sclose(mspace_id);
+            }
             free(size_offset_dims);
-            mspace_id = H5Screate_simple(rank, dims, NULL);
-            err = Mat_H5WriteData(dset_id, h5_type, mspace_id, space_id, isComplex, data);
-            H5Sclose(mspace_id);
         } else {
             err = MATIO_E_OUT_OF_MEMORY;
         }
@@ -1747,11 +2111,13 @@ Mat_WriteEmptyVariable73(hid_t id, const char *name, hsize_t rank, size_t *dims)
  * @param matvar pointer to the logical variable
  * @param name Name of the HDF dataset
  * @param dims array of permuted dimensions
+ * @param max_dims maximum dimensions
  * @retval 0 on success
  * @endif
  */
 static int
-Mat_VarWriteLogical73(hid_t id, matvar_t *matvar, const char *name, hsize_t *dims)
+Mat_VarWriteLogical73(hid_t id, matvar_t *matvar, const char *name, hsize_t *dims,
+                      hsize_t *max_dims)
 {
     int err = MATIO_E_NO_ERROR, k;
     hsize_t nelems = 1;
@@ -1761,7 +2127,7 @@ Mat_VarWriteLogical73(hid_t id, matvar_t *matvar, const char *name, hsize_t *dim
         nelems *= dims[k];
     }
 
-    if ( matvar->compression == MAT_COMPRESSION_ZLIB ) {
+    if ( matvar->compression == MAT_COMPRESSION_ZLIB || NULL != max_dims ) {
         plist = H5Pcreate(H5P_DATASET_CREATE);
         if ( MAX_RANK >= matvar->rank ) {
             hsize_t chunk_dims[MAX_RANK];
@@ -1778,7 +2144,8 @@ Mat_VarWriteLogical73(hid_t id, matvar_t *matvar, const char *name, hsize_t *dim
                 return MATIO_E_OUT_OF_MEMORY;
             }
         }
-        H5Pset_deflate(plist, 9);
+        if ( matvar->compression == MAT_COMPRESSION_ZLIB )
+            H5Pset_deflate(plist, 9);
     } else {
         plist = H5P_DEFAULT;
     }
@@ -1789,7 +2156,7 @@ Mat_VarWriteLogical73(hid_t id, matvar_t *matvar, const char *name, hsize_t *dim
         int int_decode = 1;
         hid_t mspace_id, dset_id, attr_type_id, attr_id, aspace_id;
 
-        mspace_id = H5Screate_simple(matvar->rank, dims, NULL);
+        mspace_id = H5Screate_simple(matvar->rank, dims, max_dims);
         /* Note that MATLAB only recognizes uint8 as logical */
         dset_id = H5Dcreate(id, name, ClassType2H5T(MAT_C_UINT8), mspace_id, H5P_DEFAULT, plist,
                             H5P_DEFAULT);
@@ -1922,11 +2289,13 @@ Mat_VarWriteNumeric73(hid_t id, matvar_t *matvar, const char *name, hsize_t *dim
  * @param name Name of the HDF dataset
  * @param dims array of permuted dimensions
  * @param dim dimension to append data
+ * @param num_threads number of threads compressing full chunks
  * @retval 0 on success
  * @endif
  */
 static int
-Mat_VarWriteAppendNumeric73(hid_t id, matvar_t *matvar, const char *name, hsize_t *dims, int dim)
+Mat_VarWriteAppendNumeric73(hid_t id, matvar_t *matvar, const char *name, hsize_t *dims, int dim,
+                            int num_threads)
 {
     int err = MATIO_E_NO_ERROR, k;
     hsize_t nelems = 1;
@@ -1939,7 +2308,7 @@ Mat_VarWriteAppendNumeric73(hid_t id, matvar_t *matvar, const char *name, hsize_
         if ( H5Lexists(id, matvar->name, H5P_DEFAULT) ) {
             err = Mat_H5WriteAppendData(id, ClassType2H5T(matvar->class_type), matvar->rank,
                                         matvar->name, matvar->dims, dims, dim, matvar->isComplex,
-                                        matvar->data);
+                                        matvar->data, num_threads);
         } else {
             /* Create with unlimited number of dimensions */
             if ( MAX_RANK >= matvar->rank ) {
@@ -1968,6 +2337,56 @@ Mat_VarWriteAppendNumeric73(hid_t id, matvar_t *matvar, const char *name, hsize_
     return err;
 }
 
+/** @if mat_devman
+ * @brief Writes/appends a logical matlab variable to the specified HDF id with the
+ *        given name
+ *
+ * @ingroup mat_internal
+ * @param id HDF id of the parent object
+ * @param matvar pointer to the logical variable
+ * @param name Name of the HDF dataset
+ * @param dims array of permuted dimensions
+ * @param dim dimension to append data
+ * @param num_threads number of threads compressing full chunks
+ * @retval 0 on success
+ * @endif
+ */
+static int
+Mat_VarWriteAppendLogical73(hid_t id, matvar_t *matvar, const char *name, hsize_t *dims, int dim,
+                            int num_threads)
+{
+    int err = MATIO_E_NO_ERROR, k;
+    hsize_t nelems = 1;
+
+    for ( k = 0; k < matvar->rank; k++ ) {
+        nelems *= dims[k];
+    }
+
+    if ( 0 != nelems && NULL != matvar->data ) {
+        if ( H5Lexists(id, matvar->name, H5P_DEFAULT) ) {
+            err = Mat_H5WriteAppendData(id, DataType2H5T(matvar->data_type), matvar->rank,
+                                        matvar->name, matvar->dims, dims, dim, 0, matvar->data,
+                                        num_threads);
+        } else {
+            /* Create with unlimited number of dimensions */
+            hsize_t *max_dims = (hsize_t *)malloc(matvar->rank * sizeof(hsize_t));
+            if ( NULL != max_dims ) {
+                for ( k = 0; k < matvar->rank; k++ ) {
+                    max_dims[k] = H5S_UNLIMITED;
+                }
+                err = Mat_VarWriteLogical73(id, matvar, name, dims, max_dims);
+                free(max_dims);
+            } else {
+                err = MATIO_E_OUT_OF_MEMORY;
+            }
+        }
+    } else {
+        err = MATIO_E_OUTPUT_BAD_DATA;
+    }
+
+    return err;
+}
+
 /** @if mat_devman
  * @brief Writes a sparse matrix variable to the specified HDF id with the
  *        given name
@@ -2314,7 +2733,7 @@ Mat_VarWriteAppendStruct73(hid_t id, matvar_t *matvar, const char *name, hid_t *
                     for ( l = 0; l < nfields; l++ ) {
                         err = Mat_H5WriteAppendData(struct_id, H5T_STD_REF_OBJ, matvar->rank,
                                                     matvar->internal->fieldnames[l], matvar->dims,
-                                                    dims, dim, 0, refs[l]);
+                                                    dims, dim, 0, refs[l], 0);
                         if ( err )
                             break;
                     }
@@ -2379,17 +2798,19 @@ Mat_VarWriteNext73(hid_t id, matvar_t *matvar, const char *name, hid_t *refs_id)
 }
 
 static int
-Mat_VarWriteAppendNext73(hid_t id, matvar_t *matvar, const char *name, hid_t *refs_id, int dim)
+Mat_VarWriteAppendNext73(hid_t id, matvar_t *matvar, const char *name, hid_t *refs_id, int dim,
+                         int num_threads)
 {
     int err;
 
     if ( MAX_RANK >= matvar->rank ) {
         hsize_t perm_dims[MAX_RANK];
-        err = Mat_VarWriteAppendNextType73(id, matvar, name, refs_id, perm_dims, dim);
+        err = Mat_VarWriteAppendNextType73(id, matvar, name, refs_id, perm_dims, dim, num_threads);
     } else {
         hsize_t *perm_dims = (hsize_t *)malloc(matvar->rank * sizeof(hsize_t));
         if ( NULL != perm_dims ) {
-            err = Mat_VarWriteAppendNextType73(id, matvar, name, refs_id, perm_dims, dim);
+            err = Mat_VarWriteAppendNextType73(id, matvar, name, refs_id, perm_dims, dim,
+                                               num_threads);
             free(perm_dims);
         } else {
             err = MATIO_E_OUT_OF_MEMORY;
@@ -2410,7 +2831,7 @@ Mat_VarWriteNextType73(hid_t id, matvar_t *matvar, const char *name, hid_t *refs
     }
 
     if ( matvar->isLogical && matvar->class_type != MAT_C_SPARSE ) {
-        err = Mat_VarWriteLogical73(id, matvar, name, dims);
+        err = Mat_VarWriteLogical73(id, matvar, name, dims, NULL);
     } else {
         switch ( matvar->class_type ) {
             case MAT_C_DOUBLE:
@@ -2456,7 +2877,7 @@ Mat_VarWriteNextType73(hid_t id, matvar_t *matvar, const char *name, hid_t *refs
 
 static int
 Mat_VarWriteAppendNextType73(hid_t id, matvar_t *matvar, const char *name, hid_t *refs_id,
-                             hsize_t *dims, int dim)
+                             hsize_t *dims, int dim, int num_threads)
 {
     int err, k;
 
@@ -2477,7 +2898,7 @@ Mat_VarWriteAppendNextType73(hid_t id, matvar_t *matvar, const char *name, hid_t
             case MAT_C_UINT16:
             case MAT_C_INT8:
             case MAT_C_UINT8:
-                err = Mat_VarWriteAppendNumeric73(id, matvar, name, dims, dim);
+                err = Mat_VarWriteAppendNumeric73(id, matvar, name, dims, dim, num_threads);
                 break;
             case MAT_C_STRUCT:
                 err = Mat_VarWriteAppendStruct73(id, matvar, name, refs_id, dims, dim);
@@ -2495,6 +2916,8 @@ Mat_VarWriteAppendNextType73(hid_t id, matvar_t *matvar, const char *name, hid_t
                 err = MATIO_E_OUTPUT_BAD_DATA;
                 break;
         }
+    } else if ( matvar->class_type != MAT_C_SPARSE ) {
+        err = Mat_VarWriteAppendLogical73(id, matvar, name, dims, dim, num_threads);
     } else {
         err = MATIO_E_OPERATION_NOT_SUPPORTED;
     }
@@ -2574,6 +2997,7 @@ Mat_Create73(const char *matname, const char *hdr_str)
     mat->next_index = 0;
     mat->num_datasets = 0;
     mat->refs_id = -1;
+    mat->compression_threads = 0;
     mat->dir = NULL;
 
     t = time(NULL);
@@ -3293,7 +3717,8 @@ Mat_VarWriteAppend73(mat_t *mat, matvar_t *matvar, int compress, int dim)
     matvar->compression = (enum matio_compression)compress;
 
     id = *(hid_t *)mat->fp;
-    return Mat_VarWriteAppendNext73(id, matvar, matvar->name, &(mat->refs_id), dim);
+    return Mat_VarWriteAppendNext73(id, matvar, matvar->name, &(mat->refs_id), dim,
+                                    mat->compression_threads);
 }
 
 #endif
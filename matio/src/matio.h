@@ -292,6 +292,7 @@ EXTERN const char *Mat_GetHeader(mat_t *mat);
 EXTERN enum mat_ft Mat_GetVersion(mat_t *mat);
 EXTERN char **Mat_GetDir(mat_t *mat, size_t *n);
 EXTERN int Mat_Rewind(mat_t *mat);
+EXTERN int Mat_SetCompressionThreads(mat_t *mat, int num_threads);
 
 /* MAT variable functions */
 EXTERN matvar_t *Mat_VarCalloc(void);
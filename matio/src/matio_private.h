@@ -114,7 +114,8 @@ struct _mat_t
     size_t next_index;   /**< Index/File position of next variable to read */
     size_t num_datasets; /**< Number of datasets in the file */
 #if defined(MAT73) && MAT73
-    hid_t refs_id; /**< Id of the /#refs# group in HDF5 */
+    hid_t refs_id;           /**< Id of the /#refs# group in HDF5 */
+    int compression_threads; /**< Number of threads compressing appended chunks */
 #endif
     char **dir; /**< Names of the datasets in the file */
 };
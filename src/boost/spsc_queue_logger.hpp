@@ -558,11 +558,23 @@ protected:
         return max_elements_;
     }
 
+    // NOTE: elements are never destroyed on pop, so the buffer must be
+    // initialized with newly-constructed elements (as for the compile-time 
+    // sized ringbuffer) [XBOT]
+    void construct_elements()
+    {
+        for(size_type i = 0; i < max_elements_; i++)
+        {
+            new (&*array_ + i) T;
+        }
+    }
+
 public:
     explicit runtime_sized_ringbuffer(size_type max_elements):
         max_elements_(max_elements + 1)
     {
         array_ = Alloc::allocate(max_elements_);
+        construct_elements();
     }
 
     template <typename U>
@@ -570,19 +582,23 @@ public:
         Alloc(alloc), max_elements_(max_elements + 1)
     {
         array_ = Alloc::allocate(max_elements_);
+        construct_elements();
     }
 
     runtime_sized_ringbuffer(Alloc const & alloc, size_type max_elements):
         Alloc(alloc), max_elements_(max_elements + 1)
     {
         array_ = Alloc::allocate(max_elements_);
+        construct_elements();
     }
 
     ~runtime_sized_ringbuffer(void)
     {
-        // destroy all remaining items
-        T out;
-        while (pop(&out, 1)) {}
+        // destroy all items [XBOT]
+        for(size_type i = 0; i < max_elements_; i++)
+        {
+            (&*array_ + i)->~T();
+        }
 
         Alloc::deallocate(array_, max_elements_);
     }
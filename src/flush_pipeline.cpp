@@ -0,0 +1,132 @@
+#include "flush_pipeline.h"
+#include "matlogger2_backend.h"
+
+#include <cstring>
+
+using namespace XBot::matlogger2;
+
+namespace
+{
+    // number of staging buffers that are kept for reuse
+    const std::size_t MAX_FREE_JOBS = 16;
+}
+
+FlushPipeline::FlushPipeline(std::size_t max_queued_bytes):
+    _max_queued_bytes(max_queued_bytes),
+    _queued_bytes(0),
+    _pending_jobs(0),
+    _run(true)
+{
+    _writer_thread.reset(new ThreadType(&FlushPipeline::writer_main, this));
+}
+
+void FlushPipeline::write(Backend& backend,
+                          const char * var_name,
+                          const void * data,
+                          ScalarType type,
+                          int rows, int cols,
+                          int slices)
+{
+    const std::size_t size_bytes = std::size_t(rows)*cols*slices*scalar_type_size(type);
+    
+    std::unique_lock<MutexType> lock(_mutex);
+    
+    // wait for room in the queue
+    _job_done_cond.wait(lock, [this, size_bytes]
+                        {
+                            return _pending_jobs == 0 ||
+                                _queued_bytes + size_bytes <= _max_queued_bytes;
+                        });
+    
+    // reuse the staging buffer of a written job, if any
+    Job job;
+    
+    if(!_free_jobs.empty())
+    {
+        job = std::move(_free_jobs.back());
+        _free_jobs.pop_back();
+    }
+    
+    job.backend = &backend;
+    job.var_name = var_name;
+    job.type = type;
+    job.rows = rows;
+    job.cols = cols;
+    job.slices = slices;
+    
+    // staging copy (the block is returned to the producer afterwards);
+    // the lock is not needed for copying, as room has been reserved
+    _queued_bytes += size_bytes;
+    _pending_jobs++;
+    
+    lock.unlock();
+    
+    job.data.resize(size_bytes);
+    std::memcpy(job.data.data(), data, size_bytes);
+    
+    lock.lock();
+    
+    _jobs.push_back(std::move(job));
+    _job_queued_cond.notify_one();
+}
+
+void FlushPipeline::drain()
+{
+    std::unique_lock<MutexType> lock(_mutex);
+    
+    _job_done_cond.wait(lock, [this]{ return _pending_jobs == 0; });
+}
+
+void FlushPipeline::writer_main()
+{
+    std::unique_lock<MutexType> lock(_mutex);
+    
+    while(true)
+    {
+        _job_queued_cond.wait(lock, [this]{ return !_jobs.empty() || !_run; });
+        
+        if(_jobs.empty())
+        {
+            return;
+        }
+        
+        Job job = std::move(_jobs.front());
+        _jobs.pop_front();
+        
+        // the write is performed without holding the lock, so that
+        // consumers can queue further jobs meanwhile
+        lock.unlock();
+        
+        job.backend->write(job.var_name.c_str(),
+                           job.data.data(),
+                           job.type,
+                           job.rows, job.cols,
+                           job.slices);
+        
+        lock.lock();
+        
+        _queued_bytes -= job.data.size();
+        _pending_jobs--;
+        
+        if(_free_jobs.size() < MAX_FREE_JOBS)
+        {
+            _free_jobs.push_back(std::move(job));
+        }
+        
+        // both waiting consumers and drain() are notified
+        _job_done_cond.notify_all();
+    }
+}
+
+FlushPipeline::~FlushPipeline()
+{
+    drain();
+    
+    {
+        std::lock_guard<MutexType> lock(_mutex);
+        _run = false;
+        _job_queued_cond.notify_one();
+    }
+    
+    _writer_thread->join();
+}
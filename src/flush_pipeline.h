@@ -0,0 +1,102 @@
+#ifndef __XBOT_MATLOGGER2_FLUSH_PIPELINE_H__
+#define __XBOT_MATLOGGER2_FLUSH_PIPELINE_H__
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "matlogger2/utils/scalar_type.h"
+#include "matlogger2/utils/visibility.h"
+#include "thread.h"
+
+namespace XBot { namespace matlogger2 {
+
+    class Backend;
+    
+    /**
+    * @brief The FlushPipeline class decouples the consumer of variable buffers
+    * from the backend. Consumer threads (e.g. MatAppender flusher and workers)
+    * drain and gather blocks into staging buffers, which are queued to a
+    * dedicated writer thread that performs the actual (compressed) writes.
+    * The queue is bounded in size, so that consumers wait for the writer
+    * (and not the other way around) when the disk is the bottleneck.
+    */
+    class MATL2_LOCAL FlushPipeline
+    {
+    
+    public:
+    
+        typedef std::shared_ptr<FlushPipeline> Ptr;
+        
+        /**
+        * @brief Spawn the writer thread
+        *
+        * @param max_queued_bytes Maximum size of queued data (a single
+        * larger write is still accepted)
+        */
+        explicit FlushPipeline(std::size_t max_queued_bytes);
+        
+        /**
+        * @brief Queue a write to the given backend (see Backend::write());
+        * data is copied into a staging buffer. Blocks while the queue is
+        * full. Can be called by any number of threads.
+        */
+        void write(Backend& backend,
+                   const char * var_name,
+                   const void * data,
+                   ScalarType type,
+                   int rows, int cols,
+                   int slices);
+        
+        /**
+        * @brief Wait until all queued writes have been performed. Must be
+        * called before a backend that writes were queued to is closed.
+        */
+        void drain();
+        
+        /**
+        * @brief Drains the queue, and joins with the writer thread
+        */
+        ~FlushPipeline();
+    
+    private:
+    
+        struct Job
+        {
+            Backend * backend;
+            std::string var_name;
+            ScalarType type;
+            int rows;
+            int cols;
+            int slices;
+            std::vector<char> data;
+        };
+        
+        void writer_main();
+        
+        const std::size_t _max_queued_bytes;
+        
+        // queued jobs, and jobs whose buffers can be reused
+        std::deque<Job> _jobs;
+        std::vector<Job> _free_jobs;
+        
+        // size of queued data, and number of jobs that have been queued
+        // but not written yet (including the one being written)
+        std::size_t _queued_bytes;
+        int _pending_jobs;
+        
+        bool _run;
+        
+        MutexType _mutex;
+        
+        // signaled when a job is queued, and when a job is written
+        CondVarType _job_queued_cond;
+        CondVarType _job_done_cond;
+        
+        std::unique_ptr<ThreadType> _writer_thread;
+    };
+    
+} }
+
+#endif
@@ -4,8 +4,10 @@
 #include <algorithm>
 #include <atomic>
 #include <list>
+#include <vector>
 
 #include "thread.h"
+#include "flush_pipeline.h"
 
 namespace
 {
@@ -41,11 +43,18 @@ struct MatAppender::Impl
     // call flush_available_data() on all alive loggers
     int  flush_available_data_all();
     
+    // main function for worker threads
+    void worker_main();
+    
+    // flush loggers of the current round until none is left
+    void flush_round_loggers();
+    
     // callback that notifies when a enough data is available
     void on_block_available(VariableBuffer::BufferInfo buf_info);
     
-    // bytes available on the queue
-    int _available_bytes;
+    // bytes available on the queue (the callback can be invoked by
+    // multiple producer threads, see MatLogger2::Lane)
+    std::atomic<int> _available_bytes;
     
     // pointer flusher thread
     std::unique_ptr<ThreadType> _flush_thread;
@@ -60,6 +69,39 @@ struct MatAppender::Impl
     // flag specifying if the flusher thread should exit
     std::atomic<bool> _flush_thread_run;
     
+    // maximum time that the flusher thread waits for notifications, as set 
+    // by set_wakeup_period() (0 if no periodic wake up is required)
+    std::atomic<int> _wakeup_period_ms;
+    
+    // wake up period that also respects the maximum block age of the 
+    // variables of registered loggers
+    int get_wakeup_period();
+    
+    // wake up the flusher thread
+    void wake_up();
+    
+    // worker threads that help the flusher thread (num_workers - 1)
+    int _num_workers;
+    std::vector<std::unique_ptr<ThreadType>> _workers;
+    
+    // alive loggers that are flushed during the current round, index of 
+    // the next one to be taken over, and flushed bytes
+    std::vector<MatLogger2::Ptr> _round_loggers;
+    std::atomic<int> _round_next;
+    std::atomic<int> _round_bytes;
+    
+    // mutex and condition variables for starting a round, and for 
+    // waiting for workers to complete it
+    MutexType _round_mutex;
+    CondVarType _round_start_cond;
+    CondVarType _round_done_cond;
+    int _round_id;
+    int _busy_workers;
+    bool _workers_run;
+    
+    // writer stage that is shared by all registered loggers (optional)
+    FlushPipeline::Ptr _pipeline;
+    
     Impl();
     
 };
@@ -72,7 +114,14 @@ MatAppender::Ptr MatAppender::MakeInstance()
 MatAppender::Impl::Impl():
     _available_bytes(0),
     _flush_thread_wake_up(false),
-    _flush_thread_run(false)
+    _flush_thread_run(false),
+    _wakeup_period_ms(0),
+    _num_workers(1),
+    _round_next(0),
+    _round_bytes(0),
+    _round_id(0),
+    _busy_workers(0),
+    _workers_run(false)
 {
 
 }
@@ -100,13 +149,46 @@ void MatAppender::Impl::on_block_available(VariableBuffer::BufferInfo buf_info)
     if(_available_bytes > NOTIFY_THRESHOLD_BYTES || 
         buf_info.variable_free_space < NOTIFY_THRESHOLD_SPACE_AVAILABLE)
     {
-        std::lock_guard<MutexType> lock(_cond_mutex);
-        
         _available_bytes = 0;
-        _flush_thread_wake_up = true; 
-        _cond.notify_one(); 
         
+        wake_up();
+    }
+}
+
+void MatAppender::Impl::wake_up()
+{
+    std::lock_guard<MutexType> lock(_cond_mutex);
+    
+    _flush_thread_wake_up = true; 
+    _cond.notify_one(); 
+}
+
+int MatAppender::Impl::get_wakeup_period()
+{
+    int period_ms = _wakeup_period_ms;
+    
+    std::lock_guard<MutexType> lock(_loggers_mutex);
+    
+    // partially filled blocks must be checked often enough to respect 
+    // their maximum age
+    for(const auto& logger_weak : _loggers)
+    {
+        auto logger = logger_weak.lock();
+        
+        const int max_block_age_ms = logger ? logger->get_min_block_age() : 0;
+        
+        if(max_block_age_ms > 0)
+        {
+            const int age_period_ms = std::max(1, max_block_age_ms/2);
+            
+            if(period_ms == 0 || age_period_ms < period_ms)
+            {
+                period_ms = age_period_ms;
+            }
+        }
     }
+    
+    return period_ms;
 }
 
 MatAppender::MatAppender()
@@ -179,12 +261,77 @@ bool MatAppender::add_logger(std::shared_ptr<MatLogger2> logger)
         }
     );
     
+    // the flusher thread recomputes its wake up period when a variable with 
+    // a shorter maximum block age is created
+    logger->set_on_min_block_age_changed(
+        [this, self]()
+        {
+            auto self_shared_ptr = self.lock();
+            
+            if(self_shared_ptr)
+            {
+                impl().wake_up();
+            }
+        }
+    );
+    
     // register the logger
+    logger->set_flush_pipeline(impl()._pipeline);
     impl()._loggers.emplace_back(logger);
     
     return true;
 }
 
+void MatAppender::set_wakeup_period(int period_ms)
+{
+    impl()._wakeup_period_ms = std::max(0, period_ms);
+}
+
+bool MatAppender::set_num_workers(int num_workers)
+{
+    if(impl()._flush_thread || num_workers < 1)
+    {
+        fprintf(stderr, "error in %s: invalid number of workers %d, or flusher thread already running\n", 
+                __PRETTY_FUNCTION__, num_workers);
+        return false;
+    }
+    
+    impl()._num_workers = num_workers;
+    
+    return true;
+}
+
+bool MatAppender::set_write_queue_size(int max_queued_bytes)
+{
+    if(impl()._flush_thread || max_queued_bytes < 0)
+    {
+        fprintf(stderr, "error in %s: invalid write queue size %d, or flusher thread already running\n", 
+                __PRETTY_FUNCTION__, max_queued_bytes);
+        return false;
+    }
+    
+    std::lock_guard<MutexType> lock(impl()._loggers_mutex);
+    
+    impl()._pipeline.reset();
+    
+    if(max_queued_bytes > 0)
+    {
+        impl()._pipeline = std::make_shared<FlushPipeline>(max_queued_bytes);
+    }
+    
+    // loggers (which keep the pipeline alive) drain the previous 
+    // pipeline before switching
+    for(auto& logger_weak : impl()._loggers)
+    {
+        if(auto logger = logger_weak.lock())
+        {
+            logger->set_flush_pipeline(impl()._pipeline);
+        }
+    }
+    
+    return true;
+}
+
 int MatAppender::flush_available_data()
 {
     return impl().flush_available_data_all();
@@ -193,6 +340,15 @@ int MatAppender::flush_available_data()
 void MatAppender::start_flush_thread()
 
 {
+    // spawn workers first, so that they are available from the first round
+    impl()._workers_run = true;
+    
+    for(int i = 1; i < impl()._num_workers; i++)
+    {
+        impl()._workers.emplace_back(new ThreadType(&MatAppender::Impl::worker_main, 
+                                                    _impl.get()));
+    }
+    
     impl()._flush_thread_run = true;
     impl()._flush_thread.reset(new ThreadType(&MatAppender::Impl::flush_thread_main, 
                                                _impl.get()
@@ -202,21 +358,19 @@ void MatAppender::start_flush_thread()
 
 int MatAppender::Impl::flush_available_data_all()
 {
-    int bytes = 0;
-    
     // acquire exclusive access to registered loggers list
     std::lock_guard<MutexType> lock(_loggers_mutex);
     
-    // define function that processes a single registered logger, 
+    // define function that collects a single registered logger, 
     // and marks it for removal if it is expired
-    auto process_or_remove = [&bytes](auto& logger_weak)
+    auto collect_or_remove = [this](auto& logger_weak)
     {
         // !!! this is the main synchronization point that prevents loggers 
         // to be destruced while their data is being flushed to disk !!!
         // We try to lock the current logger by creating a shared pointer
         MatLogger2::Ptr logger = logger_weak.lock();
         
-        // If we managed to lock it, it'll be kept alive till the scope exit
+        // If we managed to lock it, it'll be kept alive till the end of the round
         if(!logger)
         {
             #ifdef MATLOGGER2_VERBOSE
@@ -225,15 +379,85 @@ int MatAppender::Impl::flush_available_data_all()
             return true; // removed expired logger
         }
         
-        bytes += logger->flush_available_data();
+        _round_loggers.push_back(logger);
         
         return false; // don't remove
     };
     
-    // process all loggers, remove those that are expired
-    _loggers.remove_if(process_or_remove);
+    // collect all loggers, remove those that are expired
+    _loggers.remove_if(collect_or_remove);
     
-    return bytes;
+    _round_next = 0;
+    _round_bytes = 0;
+    
+    // wake up workers
+    if(!_workers.empty())
+    {
+        std::lock_guard<MutexType> round_lock(_round_mutex);
+        _round_id++;
+        _busy_workers = _workers.size();
+        _round_start_cond.notify_all();
+    }
+    
+    // the calling thread takes part in the round as well
+    flush_round_loggers();
+    
+    // wait for workers to complete the round
+    if(!_workers.empty())
+    {
+        std::unique_lock<MutexType> round_lock(_round_mutex);
+        _round_done_cond.wait(round_lock, [this]{ return _busy_workers == 0; });
+    }
+    
+    _round_loggers.clear();
+    
+    return _round_bytes;
+}
+
+void MatAppender::Impl::flush_round_loggers()
+{
+    // loggers are taken over one at a time, so that each of them is 
+    // flushed by a single thread
+    const int num_loggers = _round_loggers.size();
+    
+    for(int i = _round_next++; i < num_loggers; i = _round_next++)
+    {
+        _round_bytes += _round_loggers[i]->flush_available_data();
+    }
+}
+
+void MatAppender::Impl::worker_main()
+{
+    int last_round_id = 0;
+    
+    while(true)
+    {
+        // wait for a new round, or for the exit request
+        {
+            std::unique_lock<MutexType> lock(_round_mutex);
+            _round_start_cond.wait(lock, [this, last_round_id]
+                                   { 
+                                       return !_workers_run || _round_id != last_round_id; 
+                                   });
+            
+            if(!_workers_run)
+            {
+                return;
+            }
+            
+            last_round_id = _round_id;
+        }
+        
+        flush_round_loggers();
+        
+        // notify the flusher thread if this is the last worker to finish
+        std::lock_guard<MutexType> lock(_round_mutex);
+        
+        if(--_busy_workers == 0)
+        {
+            _round_done_cond.notify_one();
+        }
+    }
 }
 
 
@@ -259,9 +483,23 @@ void MatAppender::Impl::flush_thread_main()
         printf("..average load is %.2f \n", 1.0/(1.0+sleep_time_total/work_time_total));
         #endif
         
+        // computed before locking _cond_mutex, which create() can take 
+        // (see wake_up()) while holding the logger lock
+        const int wakeup_period_ms = get_wakeup_period();
+        
         std::unique_lock<MutexType> lock(_cond_mutex);
-        double sleep_time = measure_sec([this, &lock](){
-            _cond.wait(lock, [this]{ return _flush_thread_wake_up.load(); });
+        double sleep_time = measure_sec([this, &lock, wakeup_period_ms](){
+            
+            if(wakeup_period_ms > 0)
+            {
+                _cond.wait_for(lock, 
+                               std::chrono::milliseconds(wakeup_period_ms),
+                               [this]{ return _flush_thread_wake_up.load(); });
+            }
+            else
+            {
+                _cond.wait(lock, [this]{ return _flush_thread_wake_up.load(); });
+            }
         });
         
         // reset condition
@@ -297,6 +535,18 @@ MatAppender::~MatAppender()
     // join with the flusher thread
     impl()._flush_thread->join();
     
+    // then with workers
+    {
+        std::lock_guard<MutexType> lock(impl()._round_mutex);
+        impl()._workers_run = false;
+        impl()._round_start_cond.notify_all();
+    }
+    
+    for(auto& worker : impl()._workers)
+    {
+        worker->join();
+    }
+    
 }
 
 
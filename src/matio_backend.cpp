@@ -1,4 +1,5 @@
 #include "matio_backend.h"
+#include "thread.h"
 
 #include <fstream>
 #include <stdio.h>
@@ -49,11 +50,71 @@ std::string utf16_utf8(std::u16string source)
 
 }
 
+/********* ScalarType <--> MatIO class conversion utilities *********/
+
+namespace{
+
+struct MatioType
+{
+    matio_classes class_type;
+    matio_types data_type;
+    int flags;
+};
+
+MatioType get_matio_type(ScalarType type)
+{
+    switch(type)
+    {
+        case ScalarType::Single:  return {MAT_C_SINGLE, MAT_T_SINGLE, 0};
+        case ScalarType::Int8:    return {MAT_C_INT8,   MAT_T_INT8,   0};
+        case ScalarType::UInt8:   return {MAT_C_UINT8,  MAT_T_UINT8,  0};
+        case ScalarType::Int16:   return {MAT_C_INT16,  MAT_T_INT16,  0};
+        case ScalarType::UInt16:  return {MAT_C_UINT16, MAT_T_UINT16, 0};
+        case ScalarType::Int32:   return {MAT_C_INT32,  MAT_T_INT32,  0};
+        case ScalarType::UInt32:  return {MAT_C_UINT32, MAT_T_UINT32, 0};
+        case ScalarType::Int64:   return {MAT_C_INT64,  MAT_T_INT64,  0};
+        case ScalarType::UInt64:  return {MAT_C_UINT64, MAT_T_UINT64, 0};
+        case ScalarType::Logical: return {MAT_C_UINT8,  MAT_T_UINT8,  MAT_F_LOGICAL};
+        default:                  return {MAT_C_DOUBLE, MAT_T_DOUBLE, 0};
+    }
+}
+
+bool get_scalar_type(const matvar_t * mat_var, ScalarType& type)
+{
+    switch(mat_var->class_type)
+    {
+        case MAT_C_DOUBLE: type = ScalarType::Double; return true;
+        case MAT_C_SINGLE: type = ScalarType::Single; return true;
+        case MAT_C_INT8:   type = ScalarType::Int8;   return true;
+        case MAT_C_UINT8:  type = mat_var->isLogical ? ScalarType::Logical : ScalarType::UInt8; return true;
+        case MAT_C_INT16:  type = ScalarType::Int16;  return true;
+        case MAT_C_UINT16: type = ScalarType::UInt16; return true;
+        case MAT_C_INT32:  type = ScalarType::Int32;  return true;
+        case MAT_C_UINT32: type = ScalarType::UInt32; return true;
+        case MAT_C_INT64:  type = ScalarType::Int64;  return true;
+        case MAT_C_UINT64: type = ScalarType::UInt64; return true;
+        default: return false;
+    }
+}
+
+/* matio and (non thread-safe builds of) HDF5 keep global state, so that 
+ * backends of different files must not access them concurrently 
+ * (see MatAppender::set_num_workers()) */
+MutexType& library_mutex()
+{
+    static MutexType mutex;
+    return mutex;
+}
+
+}
+
 /********* Backend standard methods *********/
 
 bool MatioBackend::init(std::string logger_name,
                         bool enable_compression)
 {
+    std::lock_guard<MutexType> lock(library_mutex());
+    
     // initializes backend, given a name for the mat file
 
     int err = 0;
@@ -102,6 +163,8 @@ bool MatioBackend::init(std::string logger_name,
 
 bool MatioBackend::load(std::string matfile_path, bool enable_writing_access = false)
 {
+    std::lock_guard<MutexType> lock(library_mutex());
+    
   // loads an already existent mat file into the backend
 
     _mat_access_mode = enable_writing_access ? MAT_ACC_RDWR : MAT_ACC_RDONLY;
@@ -143,6 +206,8 @@ bool MatioBackend::load(std::string matfile_path, bool enable_writing_access = f
 
 bool MatioBackend::get_var_names(std::vector<std::string>& var_names)
 {
+    std::lock_guard<MutexType> lock(library_mutex());
+    
     // retrieves all variable names
 
     int err = 0;
@@ -191,6 +256,8 @@ bool MatioBackend::get_var_names(std::vector<std::string>& var_names)
 
 bool MatioBackend::get_matpath(const char** matname)
 {
+    std::lock_guard<MutexType> lock(library_mutex());
+    
     //retrieves the absolute path of the mat file loaded in the current instance of the backend
 
     int err = 0;
@@ -217,11 +284,14 @@ bool MatioBackend::get_matpath(const char** matname)
 }
 
 bool MatioBackend::write(const char* var_name,
-                         const double* data,
+                         const void* data,
+                         ScalarType type,
                          int rows,
                          int cols,
                          int slices)
 {
+    std::lock_guard<MutexType> lock(library_mutex());
+    
 
     // writes/appends basic numeric variables to file (i.e. matrices)
 
@@ -343,13 +413,15 @@ bool MatioBackend::write(const char* var_name,
 //    Mat_VarFree(mat_var_previous); // free pointer
 
     // create new variable with the provided data
+    MatioType matio_type = get_matio_type(type);
+    
     matvar_t* mat_var = Mat_VarCreate(var_name,
-                                      MAT_C_DOUBLE,
-                                      MAT_T_DOUBLE,
+                                      matio_type.class_type,
+                                      matio_type.data_type,
                                       n_dims,
                                       dims,
                                       (void *)data,
-                                      MAT_F_DONT_COPY_DATA);
+                                      MAT_F_DONT_COPY_DATA | matio_type.flags);
     // creation of variable failed
     if(mat_var == NULL)
     {
@@ -388,6 +460,8 @@ bool MatioBackend::write(const char* var_name,
 
 bool MatioBackend::readvar(const char* var_name, Eigen::MatrixXd& mat_data, int& slices)
 {
+    std::lock_guard<MutexType> lock(library_mutex());
+    
     // Reads basic numeric variable (i.e. matrices)
 
     int err = 0;
@@ -426,7 +500,9 @@ bool MatioBackend::readvar(const char* var_name, Eigen::MatrixXd& mat_data, int&
         return 0 == err;
     }
 
-    if ( mat_var->class_type != MAT_C_DOUBLE) {
+    ScalarType type;
+
+    if ( !get_scalar_type(mat_var, type) ) {
 
         fprintf(stderr, "MatioBackend::readvar: This method is only for reading standard numeric variables. \n");
 
@@ -440,8 +516,6 @@ bool MatioBackend::readvar(const char* var_name, Eigen::MatrixXd& mat_data, int&
     // int data_size = mat_var->data_size;
     // memmove(*data, const void* mat_var->data, data_size * mat_var->dims[0] * mat_var->dims[1]); // copying data field to memory pointed by the output data pointer to avoid losing data upon variable deletion
 
-    typedef Eigen::Map<Eigen::MatrixXd> EigenMap;
-
     int rows = mat_var->dims[0];
     int cols = mat_var->dims[1];
     int rank = mat_var->rank;
@@ -450,7 +524,13 @@ bool MatioBackend::readvar(const char* var_name, Eigen::MatrixXd& mat_data, int&
 
     slices = rank != 3 ? 1 : mat_var->dims[2];
 
-    mat_data = EigenMap((double*) mat_var->data, rows, cols * (slices)); // mapping variable data to an Eigen Matrix (slices are appended along the second dimension)
+    dispatch_scalar_type(type, [&](auto tag)
+    {
+        typedef typename decltype(tag)::type Scalar;
+        typedef Eigen::Map<Eigen::Matrix<Scalar, -1, -1>> EigenMap;
+
+        mat_data = EigenMap((Scalar*) mat_var->data, rows, cols * (slices)).template cast<double>(); // mapping variable data to an Eigen Matrix (slices are appended along the second dimension), converted to double
+    });
 
     Mat_VarFree(mat_var); // free all the memory allocated for the variable
 
@@ -460,6 +540,8 @@ bool MatioBackend::readvar(const char* var_name, Eigen::MatrixXd& mat_data, int&
 
 bool MatioBackend::delvar(const char* var_name)
 {
+    std::lock_guard<MutexType> lock(library_mutex());
+    
     // deleting a specific variable
     int err = 0;
 
@@ -485,8 +567,36 @@ bool MatioBackend::delvar(const char* var_name)
     return 0 == err;
 }
 
+bool MatioBackend::set_compression_threads(int num_threads)
+{
+    std::lock_guard<MutexType> lock(library_mutex());
+    
+    if ( _mat_file == NULL ) { // check if mat file object exists
+
+        fprintf(stderr, "MatioBackend::set_compression_threads: Failed to find mat object. Did you remember to call either the init() or load() methods first? \n");
+        return false;
+
+    }
+
+    // full chunks of appended data are deflated by num_threads threads
+    // (the library mutex is held meanwhile, as for any other write)
+    int ret = Mat_SetCompressionThreads(_mat_file, num_threads);
+
+    if(ret != 0)
+    {
+
+        fprintf(stderr, "MatioBackend::set_compression_threads: Mat_SetCompressionThreads failed with code %d \n", ret);
+        return false;
+
+    }
+
+    return true;
+}
+
 bool MatioBackend::close()
 {
+    std::lock_guard<MutexType> lock(library_mutex());
+    
     return 0 == Mat_Close(_mat_file);
 }
 
@@ -656,6 +766,8 @@ matvar_t* make_matvar(const std::string& name, const MatData& matdata)
 
 bool MatioBackend::write_container(const char* name, const MatData& data)
 {
+    std::lock_guard<MutexType> lock(library_mutex());
+    
     // based on the input matdata, builds recursively the associated MatIO variable and then writes it to file.
 
     int err = 0;
@@ -875,6 +987,8 @@ bool make_matdata(const matvar_t* mat_var, MatData& matdata)
 
 bool MatioBackend::read_container(const char* var_name, MatData& matdata)
 {
+    std::lock_guard<MutexType> lock(library_mutex());
+    
     // Based on the input var_name, read the variable from the loaded at file and
     //  Builds recursively the associated MatData object.
 
@@ -21,7 +21,9 @@ namespace XBot { namespace matlogger2 {
 
         virtual bool get_var_names(std::vector<std::string>& var_names) override;
 
-        virtual bool write(const char * var_name, const double* data, int rows, int cols, int slices) override;
+        using Backend::write;
+        
+        virtual bool write(const char * var_name, const void* data, ScalarType type, int rows, int cols, int slices) override;
         
         virtual bool write_container(const char * name, const MatData& data) override;
 
@@ -30,6 +32,8 @@ namespace XBot { namespace matlogger2 {
         virtual bool read_container(const char* var_name, MatData& data) override;
 
         virtual bool delvar(const char* var_name) override;
+        
+        virtual bool set_compression_threads(int num_threads) override;
 
         virtual bool get_matpath(const char** matname) override;
 
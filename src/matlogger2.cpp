@@ -1,9 +1,13 @@
 #include "matlogger2/matlogger2.h"
 #include <iostream>
+#include <algorithm>
+#include <deque>
+#include <unordered_set>
 #include <boost/algorithm/string.hpp>
 
 #include "thread.h"
 #include "matlogger2_backend.h"
+#include "flush_pipeline.h"
 
 
 using namespace XBot::matlogger2;
@@ -39,6 +43,269 @@ private:
     matlogger2::MutexType _mutex;
 };
 
+class MATL2_LOCAL MatLogger2::Registry
+{
+public:
+    
+    struct Entry
+    {
+        VariableBuffer * vbuf;
+        
+        // nullptr unless the variable is a record
+        const RecordLayout * layout;
+    };
+    
+    // variables are stored in groups of 64, each one with a bitmask 
+    // of the variables that have pending blocks
+    struct Group
+    {
+        static const int SIZE = 64;
+        
+        explicit Group(int offset_):
+            offset(offset_),
+            size(0),
+            pending(0),
+            aged(0),
+            next(nullptr)
+        {
+        }
+        
+        // index of the first entry among all variables
+        const int offset;
+        
+        Entry entries[SIZE];
+        
+        // number of published entries
+        std::atomic<int> size;
+        
+        // entries that have pending blocks (set by producers, cleared by 
+        // the consumer), and entries with a maximum block age
+        std::atomic<std::uint64_t> pending;
+        std::atomic<std::uint64_t> aged;
+        
+        std::atomic<Group *> next;
+    };
+    
+    Registry():
+        _first(nullptr),
+        _last(nullptr),
+        _cursor(0)
+    {
+    }
+    
+    // make a new variable visible to the consumer (must be called 
+    // with _vars_mutex held, before the variable is used)
+    void publish(VariableBuffer * vbuf, const RecordLayout * layout)
+    {
+        if(!_last || _last->size.load(std::memory_order_relaxed) == Group::SIZE)
+        {
+            // deque never relocates its elements on emplace_back
+            _groups.emplace_back(int(_groups.size())*Group::SIZE);
+            Group * group = &_groups.back();
+            
+            (_last ? _last->next : _first).store(group, std::memory_order_release);
+            _last = group;
+        }
+        
+        const int slot = _last->size.load(std::memory_order_relaxed);
+        const std::uint64_t mask = std::uint64_t(1) << slot;
+        
+        _last->entries[slot].vbuf = vbuf;
+        _last->entries[slot].layout = layout;
+        
+        // the producer marks the variable whenever a block is queued
+        vbuf->set_pending_flag(&_last->pending, mask);
+        
+        if(vbuf->get_max_block_age() > 0)
+        {
+            _last->aged.fetch_or(mask, std::memory_order_relaxed);
+        }
+        
+        _last->size.store(slot + 1, std::memory_order_release);
+    }
+    
+    // visit all published variables (safe against concurrent publish())
+    template <typename Func>
+    void for_each(Func f) const
+    {
+        for_each_group([&f](const Group& g, int size)
+        {
+            for(int i = 0; i < size; i++)
+            {
+                f(*g.entries[i].vbuf, g.entries[i].layout);
+            }
+        });
+    }
+    
+    // visit all variables with a maximum block age
+    template <typename Func>
+    void for_each_aged(Func f) const
+    {
+        for_each_group([&f](const Group& g, int size)
+        {
+            for_each_bit(g.aged.load(std::memory_order_relaxed) & low_bits(size), 
+                         [&f, &g](int slot)
+                         {
+                             f(*g.entries[slot].vbuf);
+                         });
+        });
+    }
+    
+    // visit the variables that have queued blocks once, the most endangered
+    // first (i.e. the ones with the least free space in their buffer), the
+    // others in round-robin order starting from the one after the variable 
+    // where the previous call stopped, until f returns false (consumer only);
+    // variables without pending blocks are not visited
+    template <typename Func>
+    void for_each_by_urgency(Func f)
+    {
+        _urgent.clear();
+        
+        // take the pending marks, in index order
+        for_each_group([this](Group& g, int size)
+        {
+            const std::uint64_t pending = g.pending.exchange(0, std::memory_order_acquire);
+            
+            for_each_bit(pending & low_bits(size), [this, &g](int slot)
+            {
+                const VariableBuffer& vbuf = *g.entries[slot].vbuf;
+                const int queued = vbuf.get_num_queued_blocks();
+                
+                if(queued > 0)
+                {
+                    Urgency u;
+                    u.free_space = 1.0 - queued / double(vbuf.get_num_blocks());
+                    u.group = &g;
+                    u.slot = slot;
+                    _urgent.push_back(u);
+                }
+            });
+        });
+        
+        // round-robin order, then most endangered first (stable, so that 
+        // ties keep the round-robin order)
+        std::stable_partition(_urgent.begin(), _urgent.end(), 
+                              [this](const Urgency& u)
+                              {
+                                  return u.group->offset + u.slot >= _cursor;
+                              });
+        
+        std::stable_sort(_urgent.begin(), _urgent.end(), 
+                         [](const Urgency& a, const Urgency& b)
+                         {
+                             return a.free_space < b.free_space;
+                         });
+        
+        auto it = _urgent.begin();
+        
+        for(; it != _urgent.end(); ++it)
+        {
+            const Entry& e = it->group->entries[it->slot];
+            
+            // next variable to be visited
+            _cursor = it->group->offset + it->slot + 1;
+            
+            if(!f(*e.vbuf, e.layout))
+            {
+                break;
+            }
+        }
+        
+        // variables that were left with queued blocks are marked again
+        for(auto u = _urgent.begin(); u != _urgent.end(); ++u)
+        {
+            if(u > it || u->group->entries[u->slot].vbuf->get_num_queued_blocks() > 0)
+            {
+                u->group->pending.fetch_or(std::uint64_t(1) << u->slot, 
+                                           std::memory_order_relaxed);
+            }
+        }
+    }
+    
+private:
+    
+    struct Urgency
+    {
+        double free_space;
+        Group * group;
+        int slot;
+    };
+    
+    template <typename Func>
+    void for_each_group(Func f) const
+    {
+        for(Group * g = _first.load(std::memory_order_acquire); 
+            g != nullptr; 
+            g = g->next.load(std::memory_order_acquire))
+        {
+            f(*g, g->size.load(std::memory_order_acquire));
+        }
+    }
+    
+    template <typename Func>
+    static void for_each_bit(std::uint64_t bits, Func f)
+    {
+        for(int slot = 0; bits != 0; slot++, bits >>= 1)
+        {
+            if(bits & 1)
+            {
+                f(slot);
+            }
+        }
+    }
+    
+    static std::uint64_t low_bits(int n)
+    {
+        return n == Group::SIZE ? ~std::uint64_t(0) : (std::uint64_t(1) << n) - 1;
+    }
+    
+    std::deque<Group> _groups;
+    std::atomic<Group *> _first;
+    Group * _last;
+    
+    // index of the variable where for_each_by_urgency() resumes, and its 
+    // scratch list of variables
+    int _cursor;
+    std::vector<Urgency> _urgent;
+};
+
+class MATL2_LOCAL MatLogger2::TriggerCapture
+{
+public:
+    
+    // separate MAT-file for the capture
+    Backend::UniquePtr backend;
+    
+    // capture window (steady clock, in ns)
+    std::int64_t start_ns;
+    std::int64_t end_ns;
+    
+    // variables that have handed off a block past the end of the window
+    std::unordered_set<const VariableBuffer *> done_vars;
+};
+
+namespace
+{
+    std::int64_t steady_clock_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    
+    std::int64_t seconds_to_ns(double seconds)
+    {
+        return static_cast<std::int64_t>(std::max(0.0, seconds)*1e9);
+    }
+    
+    // samples that reach the consumer later than this after the 
+    // capture window closes are not captured
+    const std::int64_t CAPTURE_GRACE_PERIOD_NS = 1000000000;
+    
+    // blocks of a variable are gathered up to this size before being 
+    // written with a single append
+    const std::size_t GATHER_MAX_BYTES = 16*1024*1024;
+}
+
 const std::string& VariableBuffer::get_name() const
 {
     return _name;
@@ -47,7 +314,13 @@ const std::string& VariableBuffer::get_name() const
 XBot::MatLogger2::Options::Options():
     enable_compression(false),
     default_buffer_size(1e4),
-    default_buffer_size_max_bytes(10*1024*1024)  // 10MB
+    default_buffer_size_max_bytes(10*1024*1024),  // 10MB
+    default_overflow_policy(VariableBuffer::OverflowPolicy::drop_current),
+    default_num_blocks(VariableBuffer::NumBlocks()),
+    default_max_block_age_ms(0),
+    preallocate_blocks(false),
+    producer_allocation(false),
+    compression_threads(0)
 {
 }
 
@@ -87,10 +360,18 @@ namespace{
 MatLogger2::MatLogger2(std::string file, Options opt):
     _file_name(file),
     _vars_mutex(new MutexImpl),
+    _registry(new Registry),
+    _gather_samples(0),
     _matdata_queue_mutex(new MutexImpl),
     _buffer_mode(VariableBuffer::Mode::producer_consumer),
-    _opt(opt)
+    _opt(opt),
+    _min_block_age_ms(0),
+    _trigger_ns(0),
+    _trigger_pre_ns(0),
+    _trigger_post_ns(0),
+    _capture_count(0)
 {
+    _trigger_lock.clear();
 
     #ifdef MATLOGGER2_VERBOSE
     std::cout <<  "\n Creating MatLogger2 object... \n" << std::endl;
@@ -139,6 +420,14 @@ MatLogger2::MatLogger2(std::string file, Options opt):
         }
     }
     
+    if(_opt.enable_compression && _opt.compression_threads > 0 && 
+        !_backend->set_compression_threads(_opt.compression_threads))
+    {
+        fprintf(stderr, "MatLogger2: unable to set %d compression threads, "
+                        "compressing within the flushing thread\n", 
+                _opt.compression_threads);
+    }
+    
 }
 
 const std::string& MatLogger2::get_filename() const
@@ -151,6 +440,18 @@ MatLogger2::Options MatLogger2::get_options() const
     return _opt;
 }
 
+int MatLogger2::get_min_block_age() const
+{
+    return _min_block_age_ms.load(std::memory_order_relaxed);
+}
+
+void MatLogger2::set_on_min_block_age_changed(std::function<void()> callback)
+{
+    std::lock_guard<MutexType> lock(_vars_mutex->get());
+    
+    _on_min_block_age_changed = callback;
+}
+
 void MatLogger2::set_on_data_available_callback(VariableBuffer::CallbackType callback)
 {
     std::lock_guard<MutexType> lock(_vars_mutex->get());    
@@ -175,8 +476,50 @@ void XBot::MatLogger2::set_buffer_mode(VariableBuffer::Mode buffer_mode)
     _buffer_mode = buffer_mode;
 }
 
+void XBot::MatLogger2::preallocate()
+{
+    std::lock_guard<MutexType> lock(_vars_mutex->get());
+    
+    for(auto& p : _vars)
+    {
+        p.second.preallocate();
+    }
+}
+
+
+XBot::MatLogger2::VariableOptions::VariableOptions():
+    buffer_size(-1),
+    num_blocks(-1),
+    block_size(-1),
+    max_block_age_ms(-1),
+    reduction(VariableBuffer::Reduction::none),
+    reduction_factor(1),
+    deadband(-1)
+{
+}
 
 bool MatLogger2::create(const std::string& var_name, int rows, int cols, int buffer_size)
+{
+    VariableOptions var_opt;
+    var_opt.buffer_size = buffer_size;
+    
+    return create_impl(var_name, rows, cols, var_opt, ScalarType::Double);
+}
+
+bool MatLogger2::create(VariableHandle& handle, 
+                        const std::string& var_name, 
+                        int rows, int cols, 
+                        const VariableOptions& var_opt)
+{
+    return create<double>(handle, var_name, rows, cols, var_opt);
+}
+
+bool MatLogger2::create_impl(const std::string& var_name, 
+                             int rows, int cols, 
+                             const VariableOptions& var_opt, 
+                             ScalarType scalar_type,
+                             const RecordLayout * layout,
+                             VariableIndex * index)
 {
     if(rows == 0 || cols == 0)
     {
@@ -184,10 +527,28 @@ bool MatLogger2::create(const std::string& var_name, int rows, int cols, int buf
                 var_name.c_str(), rows, cols);
         return false;
     }
-
+    
+    if(var_opt.reduction_factor < 1)
+    {
+        fprintf(stderr, "unable to create variable '%s': invalid reduction factor %d\n", 
+                var_name.c_str(), var_opt.reduction_factor);
+        return false;
+    }
+    
+    if(layout && var_opt.deadband >= 0)
+    {
+        fprintf(stderr, "unable to create variable '%s': deadband is not supported for records\n", 
+                var_name.c_str());
+        return false;
+    }
+    
+    int buffer_size = var_opt.buffer_size;
+    
+    int num_blocks = var_opt.num_blocks == -1 ? _opt.default_num_blocks : var_opt.num_blocks;
+    
     if(buffer_size == -1)
     { // buffer size not provided
-        const int max_buf_size = _opt.default_buffer_size_max_bytes/sizeof(double)/rows/cols;
+        const int max_buf_size = _opt.default_buffer_size_max_bytes/scalar_type_size(scalar_type)/rows/cols;
 
         buffer_size = std::min(max_buf_size, _opt.default_buffer_size);
 #ifdef MATLOGGER2_VERBOSE
@@ -200,49 +561,208 @@ bool MatLogger2::create(const std::string& var_name, int rows, int cols, int buf
                      _opt.default_buffer_size, max_buf_size);
         }
 #endif
+        
+        // reduced samples are fewer
+        if(var_opt.reduction != VariableBuffer::Reduction::none)
+        {
+            buffer_size = std::max(1, buffer_size / var_opt.reduction_factor);
+        }
     }
     
-    if(!(rows > 0 && cols > 0 && buffer_size > 0))
+    // compute block size from required buffer_size and number of blocks in
+    // queue, unless provided
+    int block_size = var_opt.block_size;
+    
+    if(block_size == -1 && num_blocks > 0)
+    {
+        block_size = buffer_size > 0 ? std::max(1, buffer_size / num_blocks) : 0;
+    }
+    
+    if(!(rows > 0 && cols > 0 && num_blocks > 0 && block_size > 0))
     {
         fprintf(stderr, "unable to create variable '%s': invalid parameters \
-(rows=%d, cols=%d, buf_size=%d)\n",
-                var_name.c_str(), rows, cols, buffer_size);
+(rows=%d, cols=%d, buf_size=%d, num_blocks=%d, block_size=%d)\n",
+                var_name.c_str(), rows, cols, buffer_size, num_blocks, block_size);
         return false;
     }
     
     std::lock_guard<MutexType> lock(_vars_mutex->get());    
     
-    // check if variable is already defined (in which case, return false)
-    auto it = _vars.find(var_name);
+    // check if variable is already defined (in which case, return false);
+    // record fields and sample indices are saved as separate variables, 
+    // so their names must be unique as well
+    std::vector<std::string> mat_names(1, var_name);
     
-    if(it != _vars.end())
+    for(int i = 0; layout && i < layout->get_num_fields(); i++)
     {
-        fprintf(stderr, "variable '%s' already exists\n", var_name.c_str());
-        return false;
+        mat_names.push_back(layout->get_fields()[i].name);
     }
     
-    // compute block size from required buffer_size and number of blocks in
-    // queue
-    int block_size = std::max(1, buffer_size / VariableBuffer::NumBlocks());
+    if(var_opt.deadband >= 0)
+    {
+        mat_names.push_back(var_name + "_idx");
+    }
+    
+    for(auto it = mat_names.begin(); it != mat_names.end(); ++it)
+    {
+        if(_mat_names.count(*it) > 0 || std::find(mat_names.begin(), it, *it) != it)
+        {
+            fprintf(stderr, "variable '%s' already exists\n", it->c_str());
+            return false;
+        }
+    }
     
     #ifdef MATLOGGER2_VERBOSE
-    printf("created variable '%s' (%d blocks, %d elem each)\n", 
-           var_name.c_str(), VariableBuffer::NumBlocks(), block_size);
+    printf("created variable '%s' (%d blocks, %d elem each, type %s)\n", 
+           var_name.c_str(), num_blocks, block_size,
+           scalar_type_name(scalar_type));
     #endif
     
     // insert VariableBuffer object inside the _vars map
-    _vars.emplace(std::piecewise_construct,
-                  std::forward_as_tuple(var_name),
-                  std::forward_as_tuple(var_name, rows, cols, block_size));
+    auto emplace_ret = _vars.emplace(std::piecewise_construct,
+                                     std::forward_as_tuple(var_name),
+                                     std::forward_as_tuple(var_name, rows, cols, block_size, scalar_type, num_blocks, 
+                                                           var_opt.deadband));
+    
+    VariableBuffer& vbuf = emplace_ret.first->second;
+    
+    _mat_names.insert(mat_names.begin(), mat_names.end());
+    
+    // index the new variable by the hash of its name
+    (index ? index : &_vars_index)->emplace(VariableName::Hash(var_name), &vbuf);
+    
+    // a record buffer holds whole frames, which are split on flush
+    if(layout)
+    {
+        _records.emplace(&vbuf, *layout);
+    }
     
     // set callback: this will be called whenever a new data block is 
     // available in the variable queue
-    _vars.at(var_name).set_on_block_available(_on_block_available);
-    _vars.at(var_name).set_buffer_mode(_buffer_mode);
+    vbuf.set_on_block_available(_on_block_available);
+    vbuf.set_buffer_mode(_buffer_mode);
+    vbuf.set_overflow_policy(_opt.default_overflow_policy);
+    vbuf.set_producer_allocation(_opt.producer_allocation);
+    vbuf.set_max_block_age(var_opt.max_block_age_ms == -1 ? 
+                           _opt.default_max_block_age_ms : var_opt.max_block_age_ms);
+    vbuf.set_reduction(var_opt.reduction, var_opt.reduction_factor);
+    
+    // blocks are only allocated on demand if there is a consumer to be 
+    // woken up when more blocks are needed
+    if(_opt.preallocate_blocks || !_on_block_available)
+    {
+        vbuf.preallocate();
+    }
+    
+    // from now on, the consumer can flush the variable
+    _registry->publish(&vbuf, layout ? &_records.at(&vbuf) : nullptr);
+    
+    // the consumer must check partially filled blocks often enough to 
+    // respect the maximum age of the new variable
+    const int max_block_age_ms = vbuf.get_max_block_age();
+    const int min_block_age_ms = _min_block_age_ms.load(std::memory_order_relaxed);
+    
+    if(max_block_age_ms > 0 && (min_block_age_ms == 0 || max_block_age_ms < min_block_age_ms))
+    {
+        _min_block_age_ms.store(max_block_age_ms, std::memory_order_relaxed);
+        
+        if(_on_min_block_age_changed)
+        {
+            _on_min_block_age_changed();
+        }
+    }
+    
+    return true;
+}
+
+bool MatLogger2::create(VariableHandle& handle, 
+                        const std::string& var_name, 
+                        int rows, int cols, 
+                        int buffer_size)
+{
+    if(!create(var_name, rows, cols, buffer_size))
+    {
+        handle = VariableHandle();
+        return false;
+    }
+    
+    handle = get_handle(var_name);
     
     return true;
 }
 
+bool MatLogger2::create_record(RecordHandle& handle, 
+                               const std::string& record_name,
+                               const RecordLayout& layout, 
+                               int buffer_size)
+{
+    handle = RecordHandle();
+    
+    if(layout.get_num_fields() == 0)
+    {
+        fprintf(stderr, "record '%s' created with no fields\n", record_name.c_str());
+        return false;
+    }
+    
+    // a frame is stored as a single element of raw bytes
+    VariableOptions var_opt;
+    var_opt.buffer_size = buffer_size;
+    
+    if(!create_impl(record_name, layout.get_size_bytes(), 1, var_opt, 
+                    ScalarType::UInt8, &layout))
+    {
+        return false;
+    }
+    
+    std::lock_guard<MutexType> lock(_vars_mutex->get());
+    
+    VariableBuffer * vbuf = &_vars.at(record_name);
+    handle = RecordHandle(vbuf, &_records.at(vbuf));
+    
+    return true;
+}
+
+MatLogger2::VariableHandle MatLogger2::get_handle(const VariableName& var_name) const
+{
+    return VariableHandle(find(var_name));
+}
+
+bool MatLogger2::set_overflow_policy(VariableHandle handle, 
+                                     VariableBuffer::OverflowPolicy policy, 
+                                     int backpressure_timeout_us)
+{
+    if(!handle._vbuf)
+    {
+        return false;
+    }
+    
+    handle._vbuf->set_overflow_policy(policy, backpressure_timeout_us);
+    
+    return true;
+}
+
+VariableBuffer::DropStats MatLogger2::get_drop_stats(VariableHandle handle) const
+{
+    if(!handle._vbuf)
+    {
+        return VariableBuffer::DropStats{0, 0};
+    }
+    
+    return handle._vbuf->get_drop_stats();
+}
+
+bool MatLogger2::snapshot(VariableHandle handle, 
+                          Eigen::MatrixXd& data, 
+                          int max_samples) const
+{
+    if(!handle._vbuf)
+    {
+        return false;
+    }
+    
+    return handle._vbuf->snapshot(data, max_samples);
+}
+
 bool MatLogger2::add(const std::string &var_name, const Eigen::Affine3d &data)
 {
     bool ok = add(var_name + "_t", data.translation());
@@ -250,10 +770,10 @@ bool MatLogger2::add(const std::string &var_name, const Eigen::Affine3d &data)
     return ok;
 }
 
-bool MatLogger2::add(const std::string& var_name, double scalar)
+bool MatLogger2::add(const VariableName& var_name, double scalar)
 {
     #ifdef MATLOGGER2_VERBOSE
-    std::cout <<  "\n Adding variable " << var_name << "\n" << std::endl;
+    std::cout <<  "\n Adding variable " << var_name.get_name() << "\n" << std::endl;
     #endif
 
     // turn scalar into a 1x1 matrix
@@ -296,6 +816,9 @@ bool MatLogger2::readvar(const std::string& var_name,
     std::cout <<  "\n Reading variable " << var_name << "\n" << std::endl;
     #endif
 
+    // queued writes must reach the file first
+    drain_flush_pipeline();
+
     bool var_read_ok  = _backend->readvar(var_name.c_str(), mat_data, slices);
 
     return var_read_ok;
@@ -309,6 +832,9 @@ bool MatLogger2::read_container(const std::string& var_name,
     std::cout <<  "\n Reading container " << var_name << "\n" << std::endl;
     #endif
 
+    // queued writes must reach the file first
+    drain_flush_pipeline();
+
     bool var_read_ok  = _backend->read_container(var_name.c_str(), matdata);
 
     return var_read_ok;
@@ -320,6 +846,9 @@ bool MatLogger2::delvar(const std::string& var_name)
     std::cout <<  "\n Deleting variable " << var_name << "\n" << std::endl;
     #endif
 
+    // queued writes must reach the file first
+    drain_flush_pipeline();
+
     bool var_del_ok = _backend->delvar(var_name.c_str());
 
     return var_del_ok;
@@ -331,12 +860,20 @@ bool MatLogger2::get_mat_var_names(std::vector<std::string>& var_names)
     std::cout <<  "\n Getting variables names \n" << std::endl;
     #endif
 
+    // queued writes must reach the file first
+    drain_flush_pipeline();
+
     bool get_var_names_ok = _backend->get_var_names(var_names);
 
     return get_var_names_ok;
 }
 
 int MatLogger2::flush_available_data()
+{
+    return flush_available_data(0, 0);
+}
+
+int MatLogger2::flush_available_data(int max_bytes, double max_seconds)
 {
     // save matdata variables
     {
@@ -356,85 +893,489 @@ int MatLogger2::flush_available_data()
     }
 
 
+    // in circular buffer mode, data only reaches disk on destruction,
+    // or as part of a triggered capture
+    if(_buffer_mode == VariableBuffer::Mode::circular_buffer)
+    {
+        return flush_trigger_capture();
+    }
+
     // number of flushed bytes is returned on exit
     int bytes = 0;
     
-    // acquire exclusive access to the _vars object
-    std::lock_guard<MutexType> lock(_vars_mutex->get());    
-    for(auto& p : _vars)
+    // current time, for checking the age of partially filled blocks
+    const auto now = std::chrono::steady_clock::now();
+    
+    const auto deadline = now + std::chrono::nanoseconds(seconds_to_ns(max_seconds));
+    
+    // budget is checked before each block (gathered data counts as written)
+    auto budget_left = [this, &bytes, max_bytes, max_seconds, deadline]()
     {
-        Eigen::MatrixXd block;
-        int valid_elems = 0;
+        if(max_bytes > 0 && bytes + int(_gather_buffer.size()) >= max_bytes)
+        {
+            return false;
+        }
         
-        // while there are blocks available for reading..
-        while(p.second.read_block(block, valid_elems))
+        return max_seconds <= 0 || std::chrono::steady_clock::now() < deadline;
+    };
+    
+    // variables are visited without locking, so that create() never 
+    // waits for disk I/O
+    _registry->for_each_aged([now](VariableBuffer& vbuf)
+    {
+        // ask the producer to hand off stale blocks
+        vbuf.request_handoff_if_stale(now);
+    });
+    
+    // variables whose buffer is closest to overflowing are drained first
+    _registry->for_each_by_urgency([this, &bytes, &budget_left](VariableBuffer& vbuf, 
+                                                                const RecordLayout * layout)
+    {
+        VariableBuffer::BlockView block;
+        
+        // while there are blocks available for reading, the backend
+        // directly writes from the queued block (or blocks are gathered
+        // into a single append), and the block is released afterwards;
+        // the first block is always written, so that progress is made
+        bool in_budget = bytes == 0 || budget_left();
+        
+        while(in_budget && vbuf.acquire_block(block))
         {
-            // get rows & cols for a single sample
-            auto dims = p.second.get_dimension();
-            
-            int rows = -1;
-            int cols = -1;
-            int slices = -1;
-            bool is_vector = false;
+            bytes += append_block(*_backend, vbuf, layout, block);
             
+            vbuf.release_block();
             
-            if(dims.second == 1) // the variable is a vector
+            in_budget = budget_left();
+        }
+        
+        bytes += flush_gathered(*_backend, vbuf, layout);
+        
+        return in_budget;
+    });
+    
+    return bytes;
+}
+
+bool MatLogger2::trigger(double pre_seconds, double post_seconds)
+{
+    if(_buffer_mode != VariableBuffer::Mode::circular_buffer)
+    {
+        fprintf(stderr, "trigger() is only available in circular_buffer mode\n");
+        return false;
+    }
+    
+    // concurrent trigger() calls: the first one wins
+    if(_trigger_lock.test_and_set(std::memory_order_acquire))
+    {
+        return false;
+    }
+    
+    // the previous request has not been taken over yet
+    if(_trigger_ns.load(std::memory_order_acquire) != 0)
+    {
+        _trigger_lock.clear(std::memory_order_release);
+        return false;
+    }
+    
+    _trigger_pre_ns.store(seconds_to_ns(pre_seconds), std::memory_order_relaxed);
+    _trigger_post_ns.store(seconds_to_ns(post_seconds), std::memory_order_relaxed);
+    _trigger_ns.store(steady_clock_ns(), std::memory_order_release);
+    
+    _trigger_lock.clear(std::memory_order_release);
+    
+    // wake up the consumer (if any)
+    if(_on_block_available)
+    {
+        VariableBuffer::BufferInfo buf_info;
+        buf_info.variable_name = "";
+        buf_info.new_available_bytes = 0;
+        buf_info.variable_free_space = 0.0;
+        _on_block_available(buf_info);
+    }
+    
+    return true;
+}
+
+int MatLogger2::flush_trigger_capture()
+{
+    // take over a pending request
+    if(!_capture)
+    {
+        const std::int64_t trigger_ns = _trigger_ns.load(std::memory_order_acquire);
+        
+        if(trigger_ns == 0)
+        {
+            return 0;
+        }
+        
+        std::unique_ptr<TriggerCapture> capture(new TriggerCapture);
+        capture->start_ns = trigger_ns - _trigger_pre_ns.load(std::memory_order_relaxed);
+        capture->end_ns = trigger_ns + _trigger_post_ns.load(std::memory_order_relaxed);
+        
+        // a new request can be made from now on
+        _trigger_ns.store(0, std::memory_order_release);
+        
+        // capture file is named after the main one
+        std::string capture_file = _file_name.substr(0, _file_name.size() - 4) + 
+            "_trigger_" + std::to_string(_capture_count++) + ".mat";
+        
+        capture->backend = Backend::MakeInstance("matio");
+        
+        if(!capture->backend || !capture->backend->init(capture_file, _opt.enable_compression))
+        {
+            fprintf(stderr, "unable to create capture file '%s'\n", capture_file.c_str());
+            return 0;
+        }
+        
+        if(_opt.enable_compression && _opt.compression_threads > 0)
+        {
+            capture->backend->set_compression_threads(_opt.compression_threads);
+        }
+        
+        _capture = std::move(capture);
+    }
+    
+    int bytes = 0;
+    
+    const std::int64_t now_ns = steady_clock_ns();
+    
+    std::size_t num_vars = 0;
+    
+    _registry->for_each([this, &bytes, &num_vars](VariableBuffer& vbuf, const RecordLayout * layout)
+    {
+        num_vars++;
+        
+        if(_capture->done_vars.count(&vbuf))
+        {
+            return;
+        }
+        
+        VariableBuffer::BlockView block;
+        
+        while(vbuf.acquire_block(block))
+        {
+            // blocks that were handed off before the window opened 
+            // are not captured
+            if(block.timestamp_ns >= _capture->start_ns)
             {
-                rows = dims.first;
-                cols = valid_elems;
-                slices = 1;
-                is_vector = true;
+                bytes += append_block(*_capture->backend, vbuf, layout, block);
             }
-            else // the variable is a matrix
+            
+            // blocks are taken out of the ring, so they are written to the
+            // main file as well (before the blocks that remain in the ring)
+            bytes += write_var_block(*_backend, vbuf, layout, block);
+            
+            vbuf.release_block();
+            
+            // the first block that was handed off after the window closed
+            // is the last one; following blocks stay in the ring
+            if(block.timestamp_ns >= _capture->end_ns)
             {
-                rows = dims.first;
-                cols = dims.second;
-                slices = valid_elems;
-                is_vector = false;
+                _capture->done_vars.insert(&vbuf);
+                break;
             }
+        }
         
-            // write block
+        bytes += flush_gathered(*_capture->backend, vbuf, layout);
+    });
+    
+    if(_capture->done_vars.size() == num_vars || 
+        now_ns > _capture->end_ns + CAPTURE_GRACE_PERIOD_NS)
+    {
+        finish_trigger_capture();
+    }
+    
+    return bytes;
+}
 
-            #ifdef MATLOGGER2_VERBOSE
-            std::cout <<  "\n Writing data of standard variable" << p.second.get_name().c_str() << " to file...\n" << std::endl;
-            #endif
+void MatLogger2::finish_trigger_capture()
+{
+    if(!_capture)
+    {
+        return;
+    }
+    
+    drain_flush_pipeline();
+    
+    _capture->backend->close();
+    _capture.reset();
+}
 
-            _backend->write(p.second.get_name().c_str(),
-                            block.data(),
-                            rows, cols, slices);
-            
-            // update bytes computation
-            bytes += block.rows() * valid_elems * sizeof(double);
+int MatLogger2::write_var_block(Backend& backend,
+                                const VariableBuffer& var,
+                                const RecordLayout * layout,
+                                const VariableBuffer::BlockView& block)
+{
+    if(layout)
+    {
+        return write_record_block(backend, *layout, block);
+    }
+    
+    #ifdef MATLOGGER2_VERBOSE
+    std::cout <<  "\n Writing data of standard variable" << var.get_name().c_str() << " to file...\n" << std::endl;
+    #endif
+    
+    int bytes = write_block(backend,
+                            var.get_name().c_str(),
+                            block.data,
+                            var.get_scalar_type(),
+                            var.get_dimension(),
+                            block.valid_elements);
+    
+    // samples that were skipped by change detection are identified by 
+    // the index of the written ones
+    if(block.indices)
+    {
+        bytes += write_block(backend,
+                             (var.get_name() + "_idx").c_str(),
+                             reinterpret_cast<const char *>(block.indices),
+                             ScalarType::Int64,
+                             std::make_pair(1, 1),
+                             block.valid_elements);
+    }
+    
+    return bytes;
+}
+
+int MatLogger2::append_block(Backend& backend,
+                             const VariableBuffer& var,
+                             const RecordLayout * layout,
+                             const VariableBuffer::BlockView& block)
+{
+    // a single pending block is written without copying it
+    if(_gather_samples == 0 && var.get_num_queued_blocks() == 0)
+    {
+        return write_var_block(backend, var, layout, block);
+    }
+    
+    _gather_buffer.insert(_gather_buffer.end(), block.data, block.data + block.size_bytes);
+    
+    if(block.indices)
+    {
+        _gather_indices.insert(_gather_indices.end(), 
+                               block.indices, block.indices + block.valid_elements);
+    }
+    
+    _gather_samples += block.valid_elements;
+    
+    // bound the memory that is used for gathering
+    if(_gather_buffer.size() >= GATHER_MAX_BYTES)
+    {
+        return flush_gathered(backend, var, layout);
+    }
+    
+    return 0;
+}
+
+int MatLogger2::flush_gathered(Backend& backend,
+                               const VariableBuffer& var,
+                               const RecordLayout * layout)
+{
+    if(_gather_samples == 0)
+    {
+        return 0;
+    }
+    
+    // gathered samples are written as a single block
+    VariableBuffer::BlockView block;
+    block.data = _gather_buffer.data();
+    block.valid_elements = _gather_samples;
+    block.size_bytes = _gather_buffer.size();
+    block.timestamp_ns = 0;
+    block.indices = _gather_indices.empty() ? nullptr : _gather_indices.data();
+    
+    int bytes = write_var_block(backend, var, layout, block);
+    
+    // capacity is kept for the next variables
+    _gather_buffer.clear();
+    _gather_indices.clear();
+    _gather_samples = 0;
+    
+    return bytes;
+}
+
+int MatLogger2::write_record_block(Backend& backend,
+                                   const RecordLayout& layout, 
+                                   const VariableBuffer::BlockView& block)
+{
+    int bytes = 0;
+    
+    // the block contains whole frames: gather each field into a 
+    // contiguous buffer, and write it as a separate variable
+    const int frame_size = layout.get_size_bytes();
+    
+    for(const auto& field : layout.get_fields())
+    {
+        const int field_size = field.get_size_bytes();
+        
+        _record_buffer.resize(block.valid_elements*field_size);
+        
+        for(int i = 0; i < block.valid_elements; i++)
+        {
+            std::memcpy(_record_buffer.data() + i*field_size, 
+                        block.data + i*frame_size + field.offset,
+                        field_size);
         }
+        
+        #ifdef MATLOGGER2_VERBOSE
+        std::cout <<  "\n Writing data of record field" << field.name << " to file...\n" << std::endl;
+        #endif
+        
+        bytes += write_block(backend,
+                             field.name.c_str(),
+                             _record_buffer.data(),
+                             field.scalar_type,
+                             std::make_pair(field.rows, field.cols),
+                             block.valid_elements);
     }
     
     return bytes;
 }
 
-XBot::VariableBuffer * XBot::MatLogger2::find_or_create(const std::string& var_name, 
+int MatLogger2::write_block(Backend& backend,
+                            const char * var_name, 
+                            const char * data, 
+                            ScalarType scalar_type,
+                            std::pair<int, int> dims,
+                            int valid_elems)
+{
+    int rows = -1;
+    int cols = -1;
+    int slices = -1;
+    
+    if(dims.second == 1) // the variable is a vector
+    {
+        rows = dims.first;
+        cols = valid_elems;
+        slices = 1;
+    }
+    else // the variable is a matrix
+    {
+        rows = dims.first;
+        cols = dims.second;
+        slices = valid_elems;
+    }
+    
+    if(_pipeline)
+    {
+        _pipeline->write(backend, var_name, data, scalar_type, rows, cols, slices);
+    }
+    else
+    {
+        backend.write(var_name, data, scalar_type, rows, cols, slices);
+    }
+    
+    return dims.first*dims.second*valid_elems*scalar_type_size(scalar_type);
+}
+
+XBot::VariableBuffer * XBot::MatLogger2::find(const VariableName& var_name) const
+{
+    return find(_vars_index, var_name);
+}
+
+XBot::VariableBuffer * XBot::MatLogger2::find(const VariableIndex& index, 
+                                              const VariableName& var_name)
+{
+    // look for var_name among variables with the same hash
+    auto range = index.equal_range(var_name.get_hash());
+    
+    for(auto it = range.first; it != range.second; ++it)
+    {
+        if(it->second->get_name() == var_name.get_name())
+        {
+            return it->second;
+        }
+    }
+    
+    return nullptr;
+}
+
+XBot::VariableBuffer * XBot::MatLogger2::find_or_create(const VariableName& var_name, 
                                                         int rows, int cols)
 {    
     // try to find var_name
-    auto it = _vars.find(var_name);
+    VariableBuffer * vbuf = find(var_name);
     
     // if we found it, return a valid pointer
-    if(it != _vars.end())
+    if(vbuf)
     {
-        return &(it->second);
+        return vbuf;
     }
     
     // if it was not found, and we cannot create it, return nullptr
-    if(!create(var_name, rows, cols))
+    // (this is the only case where a std::string is constructed)
+    if(!create(var_name.get_name().to_string(), rows, cols))
     {
          return nullptr;
     }
     
     // we managed to create the variable, try again to find it
-    return find_or_create(var_name, rows, cols);
+    return find(var_name);
     
 }
 
 
+MatLogger2::Lane::Ptr MatLogger2::make_lane()
+{
+    return Lane::Ptr(new Lane(*this));
+}
+
+MatLogger2::Lane::Lane(MatLogger2& logger):
+    _logger(logger)
+{
+}
+
+MatLogger2::VariableHandle MatLogger2::Lane::get_handle(const VariableName& var_name) const
+{
+    return VariableHandle(MatLogger2::find(_index, var_name));
+}
+
+bool MatLogger2::Lane::add(const VariableName& var_name, double data)
+{
+    return add(var_name, Eigen::Matrix<double, 1, 1>(data));
+}
+
+bool MatLogger2::Lane::add(VariableHandle handle, double data)
+{
+    return _logger.add(handle, data);
+}
+
+XBot::VariableBuffer * MatLogger2::Lane::find_or_create(const VariableName& var_name, 
+                                                        int rows, int cols)
+{
+    VariableBuffer * vbuf = MatLogger2::find(_index, var_name);
+    
+    if(vbuf)
+    {
+        return vbuf;
+    }
+    
+    // the variable is created with default options, and indexed by this lane
+    if(!_logger.create_impl(var_name.get_name().to_string(), rows, cols, 
+                            VariableOptions(), ScalarType::Double,
+                            nullptr, &_index))
+    {
+        return nullptr;
+    }
+    
+    return MatLogger2::find(_index, var_name);
+}
+
+void MatLogger2::set_flush_pipeline(std::shared_ptr<FlushPipeline> pipeline)
+{
+    drain_flush_pipeline();
+    
+    _pipeline = pipeline;
+}
+
+void MatLogger2::drain_flush_pipeline()
+{
+    if(_pipeline)
+    {
+        _pipeline->drain();
+    }
+}
+
 bool MatLogger2::flush_to_queue_all()
 {
     bool ret = true;
@@ -455,7 +1396,9 @@ MatLogger2::~MatLogger2()
     // de-register any callback
     set_on_data_available_callback(VariableBuffer::CallbackType());
     
-    // set producer_consumer mode to be able to call read_block()
+    // complete any ongoing capture, then set producer_consumer mode to be 
+    // able to flush all data to the main file
+    finish_trigger_capture();
 
     set_buffer_mode(VariableBuffer::Mode::producer_consumer);
 
@@ -478,6 +1421,7 @@ MatLogger2::~MatLogger2()
     #ifdef MATLOGGER2_VERBOSE
     std::cout <<  "\n Closing backend ...\n" << std::endl;
     #endif
+    drain_flush_pipeline();
     _backend->close();
 }
 
@@ -83,7 +83,7 @@ virtual bool close(){return true;}
 virtual bool init(std::string logger_name, bool compression){return true;}
 virtual bool load(std::string matfile_path, bool enable_write_access = false){return true;}
 virtual bool get_var_names(std::vector<std::string>& var_names){return true;}
-virtual bool write(const char* var_name, const double* data, int rows, int cols, int slices){return true;}
+virtual bool write(const char* var_name, const void* data, XBot::matlogger2::ScalarType type, int rows, int cols, int slices){return true;}
 virtual bool readvar(const char* var_name, Eigen::MatrixXd& mat_data, int& slices){return true;}  
 virtual bool read_container(const char* var_name, XBot::matlogger2::MatData& data){return true;}
 virtual bool get_matpath(const char** matname){return true;}
@@ -101,6 +101,11 @@ XBot::matlogger2::Backend::UniquePtr XBot::matlogger2::Backend::MakeInstance(std
     return GetFactory<Backend>("libmatlogger2-backend-" + type + MATLOGGER2_LIB_EXT);
 }
 
+bool XBot::matlogger2::Backend::write(const char * var_name, const double * data, int rows, int cols, int slices)
+{
+    return write(var_name, data, ScalarType::Double, rows, cols, slices);
+}
+
 bool XBot::matlogger2::Backend::write_container(const char * name, const XBot::matlogger2::MatData& data)
 {
     return false;
@@ -111,4 +116,9 @@ bool XBot::matlogger2::Backend::read_container(const char * name, XBot::matlogge
     return false;
 }
 
+bool XBot::matlogger2::Backend::set_compression_threads(int num_threads)
+{
+    return num_threads == 0;
+}
+
 
@@ -7,6 +7,7 @@
 #include <vector>
 
 #include "matlogger2/mat_data.h"
+#include "matlogger2/utils/scalar_type.h"
 
 #include "Eigen/Dense"
 
@@ -31,10 +32,20 @@ namespace XBot { namespace matlogger2 {
 
         virtual bool get_var_names(std::vector<std::string>& var_names) = 0;
 
+        /**
+        * @brief Write (append) rows x cols x slices elements of the given type,
+        * stored column-wise
+        */
         virtual bool write(const char* var_name, 
-                           const double* data, 
+                           const void* data, 
+                           ScalarType type,
                            int rows, int cols, 
                            int slices) = 0;
+        
+        bool write(const char* var_name, 
+                   const double* data, 
+                   int rows, int cols, 
+                   int slices);
 
         virtual bool write_container(const char* name,
                            const MatData& data);
@@ -47,6 +58,13 @@ namespace XBot { namespace matlogger2 {
                                     MatData& data);
 
         virtual bool delvar(const char* var_name) = 0;
+        
+        /**
+        * @brief Compress data written by write() with the given number of
+        * threads (0 for compressing within the calling thread). Returns
+        * false if unsupported by the backend.
+        */
+        virtual bool set_compression_threads(int num_threads);
 
         virtual bool get_matpath(const char** matname) =  0;
         
@@ -0,0 +1,81 @@
+#include "matlogger2/utils/record_layout.h"
+
+#include <stdexcept>
+
+using namespace XBot::matlogger2;
+
+namespace
+{
+    // frames are padded to a multiple of the largest scalar size, so that
+    // consecutive frames inside a block keep all fields aligned
+    const int FRAME_ALIGNMENT = 8;
+    
+    int align(int offset, int alignment)
+    {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+}
+
+int RecordLayout::Field::get_size() const
+{
+    return rows*cols;
+}
+
+int RecordLayout::Field::get_size_bytes() const
+{
+    return get_size()*scalar_type_size(scalar_type);
+}
+
+RecordLayout::RecordLayout():
+    _size_bytes(0)
+{
+}
+
+RecordLayout& RecordLayout::add_field(const std::string& name, 
+                                      int rows, int cols, 
+                                      ScalarType scalar_type)
+{
+    if(rows <= 0 || cols <= 0)
+    {
+        throw std::invalid_argument("record field '" + name + "' has invalid dimensions");
+    }
+    
+    for(const auto& f : _fields)
+    {
+        if(f.name == name)
+        {
+            throw std::invalid_argument("record field '" + name + "' already exists");
+        }
+    }
+    
+    // end of the last field
+    int end = _fields.empty() ? 0 : _fields.back().offset + _fields.back().get_size_bytes();
+    
+    Field f;
+    f.name = name;
+    f.rows = rows;
+    f.cols = cols;
+    f.scalar_type = scalar_type;
+    f.offset = align(end, scalar_type_size(scalar_type));
+    
+    _fields.push_back(f);
+    
+    _size_bytes = align(f.offset + f.get_size_bytes(), FRAME_ALIGNMENT);
+    
+    return *this;
+}
+
+const std::vector<RecordLayout::Field>& RecordLayout::get_fields() const
+{
+    return _fields;
+}
+
+int RecordLayout::get_num_fields() const
+{
+    return _fields.size();
+}
+
+int RecordLayout::get_size_bytes() const
+{
+    return _size_bytes;
+}
@@ -0,0 +1,28 @@
+#include "matlogger2/utils/scalar_type.h"
+
+int XBot::matlogger2::scalar_type_size(ScalarType type)
+{
+    return dispatch_scalar_type(type, [](auto tag)
+    {
+        return int(sizeof(typename decltype(tag)::type));
+    });
+}
+
+const char * XBot::matlogger2::scalar_type_name(ScalarType type)
+{
+    switch(type)
+    {
+        case ScalarType::Double:  return "double";
+        case ScalarType::Single:  return "single";
+        case ScalarType::Int8:    return "int8";
+        case ScalarType::UInt8:   return "uint8";
+        case ScalarType::Int16:   return "int16";
+        case ScalarType::UInt16:  return "uint16";
+        case ScalarType::Int32:   return "int32";
+        case ScalarType::UInt32:  return "uint32";
+        case ScalarType::Int64:   return "int64";
+        case ScalarType::UInt64:  return "uint64";
+        case ScalarType::Logical: return "logical";
+        default:                  return "unknown";
+    }
+}
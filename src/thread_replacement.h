@@ -5,6 +5,9 @@
  * using POSIX */
 
 #include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <chrono>
 #include <functional>
 #include <mutex>
 
@@ -159,6 +162,13 @@ namespace XBot { namespace matlogger2
                 throw std::runtime_error("error in pthread_condattr_setpshared (" + std::to_string(ret_1) + ")");
             }
             
+            // timeouts are measured with the monotonic clock (see wait_for())
+            int ret_2 = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+            if(0 != ret_2)
+            {
+                throw std::runtime_error("error in pthread_condattr_setclock (" + std::to_string(ret_2) + ")");
+            }
+            
             int ret = pthread_cond_init(&_handle, &attr);
             if(ret != 0){
                 throw std::runtime_error("error initializing condition_variable (" + std::to_string(ret) + ")");
@@ -179,6 +189,41 @@ namespace XBot { namespace matlogger2
             }
         }
         
+        template <typename Rep, typename Period, typename Predicate>
+        bool wait_for(std::unique_lock<mutex>& lock, 
+                      const std::chrono::duration<Rep, Period>& timeout,
+                      const Predicate& pred)
+        {
+            pthread_mutex_t * mutex = lock.mutex()->get_native_handle();
+            
+            // absolute deadline
+            timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            
+            auto timeout_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+            deadline.tv_sec += timeout_ns / 1000000000;
+            deadline.tv_nsec += timeout_ns % 1000000000;
+            
+            if(deadline.tv_nsec >= 1000000000)
+            {
+                deadline.tv_sec += 1;
+                deadline.tv_nsec -= 1000000000;
+            }
+            
+            while(!pred())
+            {
+                int ret = pthread_cond_timedwait(&_handle, mutex, &deadline);
+                if(ret == ETIMEDOUT){
+                    return pred();
+                }
+                if(ret != 0){
+                    throw std::runtime_error("error in pthread_cond_timedwait (" + std::to_string(ret) + ")");
+                }
+            }
+            
+            return true;
+        }
+        
         void notify_one()
         {
             int ret = pthread_cond_signal(&_handle);
@@ -187,6 +232,14 @@ namespace XBot { namespace matlogger2
             }
         }
         
+        void notify_all()
+        {
+            int ret = pthread_cond_broadcast(&_handle);
+            if(ret != 0){
+                throw std::runtime_error("error in pthread_cond_broadcast (" + std::to_string(ret) + ")");
+            }
+        }
+        
     private:
         
         pthread_cond_t _handle;
@@ -2,41 +2,190 @@
 
 #include "boost/spsc_queue_logger.hpp"
 #include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <cstdlib>
+#include <stdexcept>
+#include <new>
+#include <sys/mman.h>
 
 using namespace XBot;
 
+namespace
+{
+    // blocks start on a cache line boundary
+    const std::size_t CACHE_LINE_SIZE = 64;
+    
+    // slabs that are at least this large are aligned to, and backed by,
+    // (transparent) huge pages if available
+    const std::size_t HUGE_PAGE_SIZE = 2*1024*1024;
+    
+    std::int64_t steady_clock_ns(std::chrono::steady_clock::time_point t)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+    }
+    
+    std::size_t align(std::size_t size, std::size_t alignment)
+    {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+    
+    struct SlabDeleter
+    {
+        void operator()(char * ptr) const
+        {
+            std::free(ptr);
+        }
+    };
+    
+    typedef std::unique_ptr<char, SlabDeleter> SlabPtr;
+    
+    /**
+     * @brief Allocate a memory slab; its pages are not touched, so that 
+     * large slabs only reserve address space until prefault() is called
+     */
+    SlabPtr allocate_slab(std::size_t size)
+    {
+        const std::size_t alignment = size >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : CACHE_LINE_SIZE;
+        
+        void * ptr = nullptr;
+        
+        if(posix_memalign(&ptr, alignment, align(size, alignment)) != 0)
+        {
+            throw std::bad_alloc();
+        }
+        
+#ifdef MADV_HUGEPAGE
+        if(alignment == HUGE_PAGE_SIZE)
+        {
+            // just a hint, failure is not an error
+            madvise(ptr, align(size, alignment), MADV_HUGEPAGE);
+        }
+#endif
+        
+        return SlabPtr(static_cast<char *>(ptr));
+    }
+    
+    /**
+     * @brief Zero-initialize a memory region, so that all of its pages
+     * are touched here, and not inside the producer loop
+     */
+    void prefault(char * ptr, std::size_t size)
+    {
+        std::memset(ptr, 0, size);
+    }
+}
+
 VariableBuffer::BufferBlock::BufferBlock():
-    _write_idx(0),
-    _buf(0,0)
+    BufferBlock(nullptr, 0, 0, matlogger2::ScalarType::Double)
 {
 
 }
 
-VariableBuffer::BufferBlock::BufferBlock(int dim, int block_size):
+VariableBuffer::BufferBlock::BufferBlock(char * buf, int dim, int block_size, matlogger2::ScalarType scalar_type,
+                                         std::int64_t * index_buf):
     _write_idx(0),
-    _buf(dim, block_size)
+    _dim(dim),
+    _size(block_size),
+    _scalar_type(scalar_type),
+    _scalar_size(matlogger2::scalar_type_size(scalar_type)),
+    _buf(buf),
+    _index_buf(index_buf),
+    _timestamp_ns(0)
 {
+    _generation = 0;
+}
 
+VariableBuffer::BufferBlock::BufferBlock(BufferBlock&& other):
+    _write_idx(other._write_idx.load()),
+    _dim(other._dim),
+    _size(other._size),
+    _scalar_type(other._scalar_type),
+    _scalar_size(other._scalar_size),
+    _buf(other._buf),
+    _index_buf(other._index_buf),
+    _timestamp_ns(other._timestamp_ns)
+{
+    _generation = other._generation.load();
 }
 
 int VariableBuffer::BufferBlock::get_size() const
 {
-    return _buf.cols();
+    return _size;
 }
 
-const Eigen::MatrixXd& VariableBuffer::BufferBlock::get_data() const
+const char * VariableBuffer::BufferBlock::get_data() const
 {
     return _buf;
 }
 
+std::int64_t VariableBuffer::BufferBlock::get_timestamp_ns() const
+{
+    return _timestamp_ns;
+}
+
+void VariableBuffer::BufferBlock::set_timestamp_ns(std::int64_t timestamp_ns)
+{
+    _timestamp_ns = timestamp_ns;
+}
+
+const std::int64_t * VariableBuffer::BufferBlock::get_index_data() const
+{
+    return _index_buf;
+}
+
+void VariableBuffer::BufferBlock::set_last_index(std::int64_t index)
+{
+    _index_buf[_write_idx.load(std::memory_order_relaxed) - 1] = index;
+}
+
+std::uint32_t VariableBuffer::BufferBlock::get_generation() const
+{
+    return _generation.load(std::memory_order_acquire);
+}
+
 int VariableBuffer::BufferBlock::get_valid_elements() const
 {
-    return _write_idx;
+    return _write_idx.load(std::memory_order_acquire);
 }
 
 void VariableBuffer::BufferBlock::reset()
 {
-    _write_idx = 0;
+    // the generation is bumped before the content is overwritten
+    // (seqlock-like protocol, see snapshot())
+    _generation.store(_generation.load(std::memory_order_relaxed) + 1, 
+                      std::memory_order_relaxed);
+    _write_idx.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+char * VariableBuffer::BufferBlock::reserve()
+{
+    const int write_idx = _write_idx.load(std::memory_order_relaxed);
+    
+    if(write_idx == _size)
+    {
+        return nullptr;
+    }
+    
+    return _buf + write_idx*_dim*_scalar_size;
+}
+
+bool VariableBuffer::BufferBlock::commit()
+{
+    const int write_idx = _write_idx.load(std::memory_order_relaxed);
+    
+    if(write_idx == _size)
+    {
+        return false;
+    }
+    
+    _write_idx.store(write_idx + 1, std::memory_order_release);
+    
+    return true;
 }
 
 namespace lf = boost::lockfree;
@@ -44,7 +193,12 @@ namespace lf = boost::lockfree;
 /**
  * @brief The QueueImpl class implements the buffering strategy
  * for a single logged variable. This consists of:
+ *  - a memory slab for all blocks, which is reserved on construction, and 
+ *    an array of blocks, which grows on demand (from the consumer side) up
+ *    to the maximum number of blocks; blocks are exchanged by pointer
  *  - a pool of available blocks, accessed only by the producer thread
+ *  - a "grow queue": newly allocated blocks are pushed into it, and 
+ *    finally end up inside the pool
  *  - a "read queue": produces pushes ready-to-consume blocks into it
  *  - a "write queue": consumed blocks are pushed into the queue in 
  *    and finally return inside the pool
@@ -54,57 +208,436 @@ class VariableBuffer::QueueImpl
 {
 public:
     
-    // fixed number of blocks
-    static const int NUM_BLOCKS = 20;
+    // default number of blocks
+    static const int DEFAULT_NUM_BLOCKS = 20;
+    
+    // number of blocks that are allocated on construction
+    static const int INITIAL_NUM_BLOCKS = 2;
     
+    // queues capacity is set on construction
     template <typename T>
-    using LockfreeQueue = lf::spsc_queue<T, lf::capacity<NUM_BLOCKS>>;
+    using LockfreeQueue = lf::spsc_queue<T>;
     
-    QueueImpl(int elem_size, int buffer_size)
+    QueueImpl(int elem_size, int buffer_size, int num_blocks, matlogger2::ScalarType scalar_type, 
+              bool indexed = false):
+        _num_blocks(num_blocks),
+        _elem_size(elem_size),
+        _buffer_size(buffer_size),
+        _scalar_type(scalar_type),
+        _block_pool(num_blocks),
+        _pool_size(0),
+        _read_queue(num_blocks),
+        _write_queue(num_blocks),
+        _grow_queue(num_blocks),
+        _history(new HistoryEntry[num_blocks])
     {
-        // allocate all blocks and push them into the pool
-        for(int i = 0; i < NUM_BLOCKS; i++)
+        // reserve memory for all blocks at once, each block starting
+        // on a cache line
+        std::size_t block_bytes = std::size_t(elem_size) * buffer_size * 
+            matlogger2::scalar_type_size(scalar_type);
+        
+        // sample indices (if any) follow the samples of the block
+        _index_offset = 0;
+        
+        if(indexed)
+        {
+            _index_offset = align(block_bytes, sizeof(std::int64_t));
+            block_bytes = _index_offset + buffer_size*sizeof(std::int64_t);
+        }
+        
+        _block_stride = align(block_bytes, CACHE_LINE_SIZE);
+        
+        _slab = allocate_slab(_block_stride * num_blocks);
+        
+        // the block array is never reallocated, so that pointers to blocks 
+        // stay valid as it grows
+        _blocks.reserve(num_blocks);
+        _num_allocated = 0;
+        _grow_requested = false;
+        _producer_allocation = false;
+        
+        const int initial_num_blocks = INITIAL_NUM_BLOCKS;
+        allocate_blocks(std::min(num_blocks, initial_num_blocks));
+        
+        for(int i = 0; i < num_blocks; i++)
         {
-            _block_pool.push_back(std::make_shared<BufferBlock>(elem_size, buffer_size));
+            _history[i].block = nullptr;
+            _history[i].generation = 0;
         }
         
-        // pre allocate queues
-        _read_queue.reset(BufferBlock::Ptr());
-        _write_queue.reset(BufferBlock::Ptr());
+        _handoff_seq = 0;
+        _current_block = nullptr;
+        
+        _dropped_samples = 0;
+        _dropped_blocks = 0;
+        _pop_lock.clear();
+        _block_start_ns = 0;
+        _handoff_requested = false;
     }
     
     
     /**
      * @brief Get a new block from the pool, if available
      * 
-     * @return a shared pointer to a block, or a nullptr if none is available
+     * @return a pointer to a block, or a nullptr if none is available
      */
-    BufferBlock::Ptr get_new_block()
+    BufferBlock * get_new_block()
     {
-        // update pool with elements from write queue
-        _write_queue.consume_all(
-            [this](BufferBlock::Ptr block)
-            {
-                _block_pool.push_back(block);
-            }
-        );
+        // update pool with elements from write queue, and 
+        // with newly allocated blocks
+        auto push_to_pool = [this](BufferBlock * block)
+        {
+            _block_pool[_pool_size++] = block;
+        };
+        
+        _write_queue.consume_all(push_to_pool);
+        _grow_queue.consume_all(push_to_pool);
+        
+        // at least half of the allocated blocks are in use once we take one
+        // from the pool: ask the consumer for more blocks, ahead of need
+        const int num_allocated = _num_allocated.load(std::memory_order_relaxed);
         
-        if(_block_pool.empty())
+        if(num_allocated < _num_blocks && 2*(_pool_size - 1) <= num_allocated)
+        {
+            _grow_requested.store(true, std::memory_order_relaxed);
+        }
+        
+        // the consumer did not keep up with our requests: if enabled, 
+        // allocate one block here as a last resort (unless the consumer is 
+        // allocating right now)
+        if(_pool_size == 0 && _producer_allocation && allocate_blocks(1, false) > 0)
+        {
+            _grow_queue.consume_all(push_to_pool);
+        }
+        
+        if(_pool_size == 0)
         {
             return nullptr;
         }
         
-        auto ret = _block_pool.back();
+        BufferBlock * ret = _block_pool[--_pool_size];
         ret->reset();
-        _block_pool.pop_back();
         
         return ret;
     }
     
+    /**
+     * @brief True if the producer is waiting for the consumer to allocate 
+     * new blocks (see grow_if_requested())
+     */
+    bool is_grow_requested() const
+    {
+        return _grow_requested.load(std::memory_order_relaxed);
+    }
+    
+    /**
+     * @brief Allow the producer to allocate a block when the pool is empty
+     * (producer side)
+     */
+    void set_producer_allocation(bool enabled)
+    {
+        _producer_allocation = enabled;
+    }
+    
+    bool get_producer_allocation() const
+    {
+        return _producer_allocation;
+    }
+    
+    /**
+     * @brief Allocate new blocks if requested by the producer (consumer side);
+     * the number of allocated blocks is doubled every time
+     */
+    void grow_if_requested()
+    {
+        if(!_grow_requested.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+        
+        _grow_requested.store(false, std::memory_order_relaxed);
+        
+        allocate_blocks(_num_allocated.load(std::memory_order_relaxed));
+    }
+    
+    /**
+     * @brief Allocate up to count new blocks, and hand them over to the
+     * producer through the grow queue. The producer only calls this as 
+     * a last resort (see set_producer_allocation()), with wait = false.
+     * 
+     * @return the number of allocated blocks
+     */
+    int allocate_blocks(int count, bool wait = true)
+    {
+        std::unique_lock<std::mutex> lock(_grow_mutex, std::defer_lock);
+        
+        if(wait)
+        {
+            lock.lock();
+        }
+        else if(!lock.try_lock())
+        {
+            return 0;
+        }
+        
+        count = std::max(0, count);
+        
+        count = std::min(count, _num_blocks - int(_blocks.size()));
+        
+        for(int i = 0; i < count; i++)
+        {
+            char * buf = _slab.get() + _blocks.size()*_block_stride;
+            
+            prefault(buf, _block_stride);
+            
+            std::int64_t * index_buf = _index_offset > 0 ? 
+                reinterpret_cast<std::int64_t *>(buf + _index_offset) : nullptr;
+            
+            _blocks.emplace_back(buf, _elem_size, _buffer_size, _scalar_type, index_buf);
+            
+            // grow queue capacity is the maximum number of blocks, 
+            // so this never fails
+            _grow_queue.push(&_blocks.back());
+        }
+        
+        _num_allocated.store(_blocks.size(), std::memory_order_relaxed);
+        
+        return count;
+    }
+    
+    int num_allocated() const
+    {
+        return _num_allocated.load(std::memory_order_relaxed);
+    }
+    
+    /**
+     * @brief Publish the producer's first block to snapshot readers
+     * (before any handoff)
+     */
+    void set_current_block(BufferBlock * block)
+    {
+        _current_block.store(block, std::memory_order_release);
+    }
+    
+    /**
+     * @brief Record a block that was pushed into the read queue, and the 
+     * new current block, so that snapshot readers can find them (producer side).
+     * The handoff sequence number is odd while the update is in progress, and
+     * equals twice the number of handoffs otherwise.
+     */
+    void record_handoff(BufferBlock * block, BufferBlock * current_block)
+    {
+        const std::uint64_t seq = _handoff_seq.load(std::memory_order_relaxed);
+        
+        _handoff_seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        
+        HistoryEntry& entry = _history[(seq/2) % _num_blocks];
+        entry.block.store(block, std::memory_order_relaxed);
+        entry.generation.store(block->get_generation(), std::memory_order_relaxed);
+        
+        _current_block.store(current_block, std::memory_order_relaxed);
+        
+        _handoff_seq.store(seq + 2, std::memory_order_release);
+    }
+    
+    /**
+     * @brief Copy up to max_samples of the most recent samples into data
+     * 
+     * @return False if the producer overwrote some of them while copying
+     */
+    bool try_snapshot(Eigen::MatrixXd& data, 
+                      int max_samples,
+                      matlogger2::ScalarType scalar_type) const
+    {
+        // blocks to be copied, newest first
+        struct Segment
+        {
+            const BufferBlock * block;
+            std::uint32_t generation;
+            int begin;
+            int end;
+        };
+        
+        std::vector<Segment> segments;
+        int n_samples = 0;
+        
+        const std::uint64_t handoff_seq = _handoff_seq.load(std::memory_order_acquire);
+        
+        // the producer is handing off a block
+        if(handoff_seq % 2 != 0)
+        {
+            return false;
+        }
+        
+        const std::uint64_t handoff_count = handoff_seq / 2;
+        
+        // current block
+        const BufferBlock * current = _current_block.load(std::memory_order_acquire);
+        
+        if(current)
+        {
+            const std::uint32_t generation = current->get_generation();
+            const int valid = current->get_valid_elements();
+            const int n = std::min(valid, max_samples);
+            
+            segments.push_back(Segment{current, generation, valid - n, valid});
+            n_samples += n;
+        }
+        
+        // blocks that were handed off, newest first (in circular buffer 
+        // mode, the ring holds the current block and at most _num_blocks - 1
+        // previous ones)
+        const std::uint64_t n_history = std::min<std::uint64_t>(handoff_count, _num_blocks - 1);
+        
+        for(std::uint64_t i = 1; i <= n_history && n_samples < max_samples; i++)
+        {
+            const HistoryEntry& entry = _history[(handoff_count - i) % _num_blocks];
+            const BufferBlock * block = entry.block.load(std::memory_order_relaxed);
+            const std::uint32_t generation = entry.generation.load(std::memory_order_relaxed);
+            
+            // the block was already reused (or consumed): older samples 
+            // are not available
+            if(block->get_generation() != generation)
+            {
+                break;
+            }
+            
+            const int valid = block->get_valid_elements();
+            const int n = std::min(valid, max_samples - n_samples);
+            
+            segments.push_back(Segment{block, generation, valid - n, valid});
+            n_samples += n;
+        }
+        
+        // copy samples, oldest first
+        data.resize(_elem_size, n_samples);
+        
+        int col = 0;
+        
+        for(auto it = segments.rbegin(); it != segments.rend(); ++it)
+        {
+            const int n = it->end - it->begin;
+            
+            matlogger2::dispatch_scalar_type(scalar_type, [&](auto tag)
+            {
+                typedef typename decltype(tag)::type Scalar;
+                data.middleCols(col, n) = it->block->template get_data_as<Scalar>()
+                    .middleCols(it->begin, n).template cast<double>();
+            });
+            
+            col += n;
+        }
+        
+        // check that nothing was overwritten while copying
+        std::atomic_thread_fence(std::memory_order_acquire);
+        
+        if(_handoff_seq.load(std::memory_order_relaxed) != handoff_seq)
+        {
+            return false;
+        }
+        
+        for(const auto& seg : segments)
+        {
+            if(seg.block->get_generation() != seg.generation)
+            {
+                return false;
+            }
+        }
+        
+        return true;
+    }
+    
+    /**
+     * @brief Return a block to the pool (producer side)
+     */
+    void return_to_pool(BufferBlock * block)
+    {
+        block->reset();
+        _block_pool[_pool_size++] = block;
+    }
+    
+    /**
+     * @brief Pop a block from the read queue (consumer side). Note that
+     * the producer can also pop from the read queue (see try_pop_oldest()),
+     * so a lock is needed to preserve the single consumer constraint.
+     */
+    bool pop(BufferBlock *& block)
+    {
+        while(_pop_lock.test_and_set(std::memory_order_acquire))
+        {
+            std::this_thread::yield();
+        }
+        
+        bool ret = _read_queue.pop(block);
+        
+        _pop_lock.clear(std::memory_order_release);
+        
+        return ret;
+    }
+    
+    /**
+     * @brief Pop the oldest block from the read queue (producer side). 
+     * This never blocks: if the consumer is popping at the same time, 
+     * it returns false.
+     */
+    bool try_pop_oldest(BufferBlock *& block)
+    {
+        if(_pop_lock.test_and_set(std::memory_order_acquire))
+        {
+            return false;
+        }
+        
+        bool ret = _read_queue.pop(block);
+        
+        _pop_lock.clear(std::memory_order_release);
+        
+        return ret;
+    }
+    
+    /**
+     * @brief Update drop counters (producer side)
+     */
+    void count_dropped(int samples, int blocks)
+    {
+        // only the producer writes the counters, so we don't need 
+        // an atomic read-modify-write
+        _dropped_samples.store(_dropped_samples.load(std::memory_order_relaxed) + samples, 
+                               std::memory_order_relaxed);
+        _dropped_blocks.store(_dropped_blocks.load(std::memory_order_relaxed) + blocks, 
+                              std::memory_order_relaxed);
+    }
+    
+    DropStats get_drop_stats() const
+    {
+        DropStats stats;
+        stats.dropped_samples = _dropped_samples.load(std::memory_order_relaxed);
+        stats.dropped_blocks = _dropped_blocks.load(std::memory_order_relaxed);
+        return stats;
+    }
+    
+    /**
+     * @brief Time of the first sample of the producer's current block (in ns
+     * from the steady clock epoch), or 0 if the current block is empty
+     */
+    std::atomic<std::int64_t>& block_start_ns()
+    {
+        return _block_start_ns;
+    }
+    
+    /**
+     * @brief Flag that the consumer sets to ask the producer to push its
+     * current block into the queue
+     */
+    std::atomic<bool>& handoff_requested()
+    {
+        return _handoff_requested;
+    }
+    
     /**
      * @brief Handle to the read queue
      */
-    LockfreeQueue<BufferBlock::Ptr>& get_read_queue()
+    LockfreeQueue<BufferBlock *>& get_read_queue()
     {
         return _read_queue;
     }
@@ -112,40 +645,123 @@ public:
     /**
      * @brief Handle to the write queue
      */
-    LockfreeQueue<BufferBlock::Ptr>& get_write_queue()
+    LockfreeQueue<BufferBlock *>& get_write_queue()
     {
         return _write_queue;
     }
     
-    static int Size()
+    int size() const
     {
-        return NUM_BLOCKS;
+        return _num_blocks;
     }
     
 private:
     
-    // pool of available blocks
-    std::vector<BufferBlock::Ptr> _block_pool;
+    // maximum number of blocks
+    int _num_blocks;
+    
+    // block geometry
+    int _elem_size;
+    int _buffer_size;
+    matlogger2::ScalarType _scalar_type;
+    std::size_t _block_stride;
+    std::size_t _index_offset;
+    
+    // memory for all blocks
+    SlabPtr _slab;
+    
+    // allocated blocks (capacity is reserved on construction, so that 
+    // growing never invalidates pointers to blocks)
+    std::vector<BufferBlock> _blocks;
+    std::atomic<int> _num_allocated;
+    
+    // set by the producer when it needs more blocks
+    std::atomic<bool> _grow_requested;
+    
+    // whether the producer allocates a block when the pool is empty
+    bool _producer_allocation;
+    
+    // serializes block allocations (consumer side and preallocate())
+    std::mutex _grow_mutex;
+    
+    // pool of available blocks (a stack with capacity _num_blocks, so
+    // that it never allocates)
+    std::vector<BufferBlock *> _block_pool;
+    int _pool_size;
     
     // queue for blocks that are ready to be flushed by consumer
-    LockfreeQueue<BufferBlock::Ptr> _read_queue;
+    LockfreeQueue<BufferBlock *> _read_queue;
     
     // queue for blocks that are ready to be filled by producer
-    LockfreeQueue<BufferBlock::Ptr> _write_queue;
+    LockfreeQueue<BufferBlock *> _write_queue;
+    
+    // queue for newly allocated blocks
+    LockfreeQueue<BufferBlock *> _grow_queue;
+    
+    // last _num_blocks blocks that were handed off (indexed by 
+    // handoff count), together with their generation at hand-off
+    struct HistoryEntry
+    {
+        std::atomic<BufferBlock *> block;
+        std::atomic<std::uint32_t> generation;
+    };
+    
+    std::unique_ptr<HistoryEntry[]> _history;
+    std::atomic<std::uint64_t> _handoff_seq;
+    
+    // producer's current block
+    std::atomic<BufferBlock *> _current_block;
+    
+    // serializes pops from the read queue
+    std::atomic_flag _pop_lock;
+    
+    // drop counters
+    std::atomic<std::uint64_t> _dropped_samples;
+    std::atomic<std::uint64_t> _dropped_blocks;
+    
+    // block age check
+    std::atomic<std::int64_t> _block_start_ns;
+    std::atomic<bool> _handoff_requested;
 };
 
 VariableBuffer::VariableBuffer(std::string name, 
                                int dim_rows,
                                int dim_cols, 
-                               int block_size):
+                               int block_size, 
+                               matlogger2::ScalarType scalar_type,
+                               int num_blocks,
+                               double deadband):
     _name(name),
     _rows(dim_rows),
     _cols(dim_cols),
-    _queue(new QueueImpl(dim_rows*dim_cols, block_size)),
-    _buffer_mode(Mode::producer_consumer)
+    _scalar_type(scalar_type),
+    _block_size(block_size),
+    _overflow_policy(OverflowPolicy::drop_current),
+    _backpressure_timeout_us(1000),
+    _max_block_age_ms(0),
+    _reduction(Reduction::none),
+    _reduction_factor(1),
+    _reduction_count(0),
+    _deadband(deadband < 0 ? -1 : deadband),
+    _sample_count(0),
+    _lent_block(nullptr),
+    _queue(new QueueImpl(dim_rows*dim_cols, block_size, num_blocks, scalar_type, 
+                         _deadband >= 0)),
+    _buffer_mode(Mode::producer_consumer),
+    _pending_word(nullptr),
+    _pending_mask(0)
 {
     // intialize current block 
     _current_block = _queue->get_new_block();
+    _queue->set_current_block(_current_block);
+    
+    // preallocate change detection state (written samples need room for 
+    // their indices as well, see QueueImpl)
+    if(_deadband >= 0)
+    {
+        _last_value.setZero(_rows*_cols);
+        _scratch_elem.assign(_rows*_cols*matlogger2::scalar_type_size(_scalar_type), 0);
+    }
 }
 
 std::pair< int, int > VariableBuffer::get_dimension() const
@@ -153,6 +769,163 @@ std::pair< int, int > VariableBuffer::get_dimension() const
     return std::make_pair(_rows, _cols);
 }
 
+matlogger2::ScalarType VariableBuffer::get_scalar_type() const
+{
+    return _scalar_type;
+}
+
+int VariableBuffer::get_num_blocks() const
+{
+    return _queue->size();
+}
+
+int VariableBuffer::get_num_allocated_blocks() const
+{
+    return _queue->num_allocated();
+}
+
+void VariableBuffer::preallocate(int num_blocks)
+{
+    if(num_blocks < 0 || num_blocks > get_num_blocks())
+    {
+        num_blocks = get_num_blocks();
+    }
+    
+    _queue->allocate_blocks(num_blocks - _queue->num_allocated());
+}
+
+void VariableBuffer::set_producer_allocation(bool enabled)
+{
+    _queue->set_producer_allocation(enabled);
+}
+
+bool VariableBuffer::get_producer_allocation() const
+{
+    return _queue->get_producer_allocation();
+}
+
+int VariableBuffer::get_block_size() const
+{
+    return _block_size;
+}
+
+void VariableBuffer::set_overflow_policy(OverflowPolicy policy, int backpressure_timeout_us)
+{
+    _overflow_policy = policy;
+    _backpressure_timeout_us = backpressure_timeout_us;
+}
+
+VariableBuffer::OverflowPolicy VariableBuffer::get_overflow_policy() const
+{
+    return _overflow_policy;
+}
+
+VariableBuffer::DropStats VariableBuffer::get_drop_stats() const
+{
+    return _queue->get_drop_stats();
+}
+
+void VariableBuffer::set_max_block_age(int max_block_age_ms)
+{
+    _max_block_age_ms = std::max(0, max_block_age_ms);
+}
+
+int VariableBuffer::get_max_block_age() const
+{
+    return _max_block_age_ms;
+}
+
+void VariableBuffer::set_reduction(Reduction reduction, int factor)
+{
+    if(factor < 1)
+    {
+        throw std::invalid_argument("invalid reduction factor " + std::to_string(factor) + 
+                                    " for variable '" + _name + "'");
+    }
+    
+    _reduction = reduction;
+    _reduction_factor = reduction == Reduction::none ? 1 : factor;
+    _reduction_count = 0;
+    
+    // preallocate reduction state (decimation does not accumulate samples)
+    if(_reduction_factor > 1 && _reduction != Reduction::decimate)
+    {
+        _reduction_acc.setZero(_rows*_cols);
+    }
+    
+    if(_reduction_factor > 1)
+    {
+        _scratch_elem.assign(_rows*_cols*matlogger2::scalar_type_size(_scalar_type), 0);
+    }
+}
+
+VariableBuffer::Reduction VariableBuffer::get_reduction() const
+{
+    return _reduction;
+}
+
+int VariableBuffer::get_reduction_factor() const
+{
+    return _reduction_factor;
+}
+
+double VariableBuffer::get_deadband() const
+{
+    return _deadband;
+}
+
+bool VariableBuffer::request_handoff_if_stale(std::chrono::steady_clock::time_point now)
+{
+    if(_max_block_age_ms <= 0)
+    {
+        return false;
+    }
+    
+    const std::int64_t block_start_ns = _queue->block_start_ns().load(std::memory_order_relaxed);
+    
+    // current block is empty
+    if(block_start_ns == 0)
+    {
+        return false;
+    }
+    
+    if(steady_clock_ns(now) - block_start_ns < _max_block_age_ms*std::int64_t(1000000))
+    {
+        return false;
+    }
+    
+    _queue->handoff_requested().store(true, std::memory_order_relaxed);
+    
+    return true;
+}
+
+void VariableBuffer::check_block_age()
+{
+    // record the time of the first sample of the block (the clock is
+    // read once per block)
+    auto& block_start_ns = _queue->block_start_ns();
+    
+    if(block_start_ns.load(std::memory_order_relaxed) == 0)
+    {
+        block_start_ns.store(steady_clock_ns(std::chrono::steady_clock::now()), 
+                             std::memory_order_relaxed);
+    }
+    
+    // push the (partially filled) block if requested by the consumer; 
+    // if the pool is exhausted, the consumer will ask again later
+    if(_queue->handoff_requested().load(std::memory_order_relaxed))
+    {
+        _queue->handoff_requested().store(false, std::memory_order_relaxed);
+        flush_to_queue();
+    }
+}
+
+void VariableBuffer::set_pending_flag(std::atomic<std::uint64_t> * word, std::uint64_t mask)
+{
+    _pending_word = word;
+    _pending_mask = mask;
+}
+
 void VariableBuffer::set_on_block_available(CallbackType callback)
 {
     _on_block_available = callback;
@@ -160,27 +933,33 @@ void VariableBuffer::set_on_block_available(CallbackType callback)
 
 int VariableBuffer::BufferBlock::get_size_bytes() const
 {
-    return _buf.size() * sizeof(_buf[0]);
+    return _size * _dim * _scalar_size;
+}
+
+int VariableBuffer::BufferBlock::get_sample_size_bytes() const
+{
+    return _dim * _scalar_size;
 }
 
 bool XBot::VariableBuffer::read_block(Eigen::MatrixXd& data, int& valid_elements)
 {
-    if(_buffer_mode == Mode::circular_buffer)
-    {
-        throw std::logic_error("cannot call read_block() when in circular_buffer mode!");
-    }
-    
     // this function is not allowed to use class members, 
     // except consuming elements from read queue
     // and pushing elements into write queue
     
     int ret = 0;
     
-    BufferBlock::Ptr block;
-    if(_queue->get_read_queue().pop(block))
+    _queue->grow_if_requested();
+    
+    BufferBlock * block = nullptr;
+    if(_queue->pop(block))
     {
-        // copy data from block to output buffer
-        data = block->get_data();
+        // copy data from block to output buffer, casting it to double
+        matlogger2::dispatch_scalar_type(_scalar_type, [&data, &block](auto tag)
+        {
+            typedef typename decltype(tag)::type Scalar;
+            data = block->get_data_as<Scalar>().template cast<double>();
+        });
         
         ret = block->get_valid_elements();
         
@@ -194,6 +973,93 @@ bool XBot::VariableBuffer::read_block(Eigen::MatrixXd& data, int& valid_elements
     return ret > 0;
 }
 
+bool VariableBuffer::snapshot(Eigen::MatrixXd& data, int max_samples) const
+{
+    const int MAX_ATTEMPTS = 10;
+    
+    for(int i = 0; i < MAX_ATTEMPTS; i++)
+    {
+        if(_queue->try_snapshot(data, std::max(0, max_samples), _scalar_type))
+        {
+            return true;
+        }
+    }
+    
+    data.resize(_rows*_cols, 0);
+    
+    return false;
+}
+
+bool XBot::VariableBuffer::read_block(std::vector<char>& data, int& valid_elements)
+{
+    BlockView view;
+    
+    if(!acquire_block(view))
+    {
+        valid_elements = 0;
+        return false;
+    }
+    
+    // copy valid samples from block to output buffer
+    data.assign(view.data, view.data + view.size_bytes);
+    valid_elements = view.valid_elements;
+    
+    release_block();
+    
+    return valid_elements > 0;
+}
+
+bool XBot::VariableBuffer::acquire_block(BlockView& view)
+{
+    if(_lent_block)
+    {
+        throw std::logic_error("acquire_block() called twice for variable '" + _name + 
+                               "' without calling release_block()");
+    }
+    
+    // this function is not allowed to use class members, 
+    // except consuming elements from read queue
+    // (and the consumer-side _lent_block)
+    
+    _queue->grow_if_requested();
+    
+    BufferBlock * block = nullptr;
+    
+    if(!_queue->pop(block))
+    {
+        return false;
+    }
+    
+    _lent_block = block;
+    
+    view.data = block->get_data();
+    view.valid_elements = block->get_valid_elements();
+    view.size_bytes = view.valid_elements * block->get_sample_size_bytes();
+    view.timestamp_ns = block->get_timestamp_ns();
+    view.indices = block->get_index_data();
+    
+    return true;
+}
+
+void XBot::VariableBuffer::release_block()
+{
+    if(!_lent_block)
+    {
+        return;
+    }
+    
+    // reset block and send it back to producer thread
+    _lent_block->reset();
+    _queue->get_write_queue().push(_lent_block);
+    
+    _lent_block = nullptr;
+}
+
+int VariableBuffer::get_num_queued_blocks() const
+{
+    return _queue->get_read_queue().read_available();
+}
+
 bool VariableBuffer::flush_to_queue()
 {
     // no valid elements in the current block, we just return true
@@ -205,11 +1071,18 @@ bool VariableBuffer::flush_to_queue()
     // fill buffer info struct
     BufferInfo buf_info;
     buf_info.new_available_bytes = _current_block->get_size_bytes();
-    buf_info.variable_free_space = _queue->get_read_queue().write_available() / (double)VariableBuffer::NumBlocks();
+    buf_info.variable_free_space = _queue->get_read_queue().write_available() / (double)get_num_blocks();
     buf_info.variable_name = _name.c_str();
     
     // try to push current block into the queue & obtain a new block
-    BufferBlock::Ptr new_block = _queue->get_new_block();
+    BufferBlock * new_block = _queue->get_new_block();
+    
+    // the producer is running out of blocks: hint that the buffer is 
+    // full, so that the consumer wakes up and allocates more of them
+    if(_queue->is_grow_requested())
+    {
+        buf_info.variable_free_space = 0.0;
+    }
     
     // handle failure to obtain new block
     if(!new_block)
@@ -219,14 +1092,18 @@ bool VariableBuffer::flush_to_queue()
         {
             // read oldest block from read queue,
             // and set it as new block
-            // NOTE: pop() is safe because read_block() cannot be called
-            // from circular_buffer mode
-            if(!_queue->get_read_queue().pop(new_block)) 
+            // NOTE: a consumer may be reading blocks at the same time (or
+            // holding all of them), in which case the overflow policy
+            // applies
+            if(!_queue->try_pop_oldest(new_block)) 
             {
-                // should never be called
-                throw std::logic_error("failed to pop a new block for variable '" + _name + "'");
+                return false;
             }
             
+            // the oldest samples are overwritten
+            _queue->count_dropped(new_block->get_valid_elements(), 1);
+            new_block->reset();
+            
         }
         else // producer-consumer mode
         {
@@ -240,6 +1117,7 @@ bool VariableBuffer::flush_to_queue()
     
     // we managed to get a new block, try to push the current into the queue
     // this should never fail
+    _current_block->set_timestamp_ns(steady_clock_ns(std::chrono::steady_clock::now()));
     bool push_to_queue_success = _queue->get_read_queue().push(_current_block);
     
     if(!push_to_queue_success)
@@ -249,8 +1127,23 @@ bool VariableBuffer::flush_to_queue()
     }
     
     // we managed to push a block into the queue
+    _queue->record_handoff(_current_block, new_block);
     _current_block = new_block;
     
+    // the new block is empty, and any handoff request is satisfied
+    if(_max_block_age_ms > 0)
+    {
+        _queue->block_start_ns().store(0, std::memory_order_relaxed);
+        _queue->handoff_requested().store(false, std::memory_order_relaxed);
+    }
+    
+    // mark the variable as pending (release, so that the consumer that 
+    // clears the mark also sees the queued block)
+    if(_pending_word)
+    {
+        _pending_word->fetch_or(_pending_mask, std::memory_order_release);
+    }
+    
     // if a callback was registered, we call it
     if(_on_block_available)
     {
@@ -261,14 +1154,147 @@ bool VariableBuffer::flush_to_queue()
         
 }
 
+bool VariableBuffer::make_room(int pending_samples)
+{
+    // try to push current block into the queue & obtain a new block
+    if(flush_to_queue())
+    {
+        _current_block->reset();
+        return true;
+    }
+    
+    // the pool is exhausted: apply overflow policy
+    switch(_overflow_policy)
+    {
+        case OverflowPolicy::drop_newest:
+        {
+            // keep the current block, new samples are lost
+            _queue->count_dropped(pending_samples, 0);
+            return false;
+        }
+        
+        case OverflowPolicy::drop_oldest:
+        {
+            // steal the oldest block from the consumer, and return it 
+            // to the pool; if the consumer is busy popping a block, 
+            // we fall back to drop_current
+            BufferBlock * oldest = nullptr;
+            
+            if(_queue->try_pop_oldest(oldest))
+            {
+                _queue->count_dropped(oldest->get_valid_elements(), 1);
+                _queue->return_to_pool(oldest);
+                
+                if(flush_to_queue())
+                {
+                    _current_block->reset();
+                    return true;
+                }
+            }
+            
+            break;
+        }
+        
+        case OverflowPolicy::backpressure:
+        {
+            // wait for the consumer to return a block, up to the timeout
+            auto deadline = std::chrono::steady_clock::now() + 
+                std::chrono::microseconds(_backpressure_timeout_us);
+            
+            do
+            {
+                std::this_thread::yield();
+                
+                if(flush_to_queue())
+                {
+                    _current_block->reset();
+                    return true;
+                }
+            }
+            while(std::chrono::steady_clock::now() < deadline);
+            
+            break;
+        }
+        
+        default:
+            break;
+    }
+    
+    // drop_current: discard the current block, and keep writing on it
+    _queue->count_dropped(_current_block->get_valid_elements(), 1);
+    _current_block->reset();
+    _queue->block_start_ns().store(0, std::memory_order_relaxed);
+    
+    return true;
+}
+
+void * VariableBuffer::reserve_elem()
+{
+    // the sample is written to a scratch element, and reduced (or checked
+    // for changes) on commit
+    if(_reduction_factor > 1 || _deadband >= 0)
+    {
+        return _scratch_elem.data();
+    }
+    
+    char * elem = _current_block->reserve();
+    
+    // if current block is full, we push it into the queue, and try again
+    if(!elem)
+    {
+        if(!make_room(1))
+        {
+            return nullptr;
+        }
+        
+        elem = _current_block->reserve();
+    }
+    
+    return elem;
+}
+
+bool VariableBuffer::commit_elem()
+{
+    if(_reduction_factor > 1 || _deadband >= 0)
+    {
+        return matlogger2::dispatch_scalar_type(_scalar_type, [this](auto tag)
+        {
+            typedef typename decltype(tag)::type Scalar;
+            
+            Eigen::Map<const Eigen::Matrix<Scalar, -1, 1>> elem(
+                reinterpret_cast<const Scalar *>(_scratch_elem.data()), _rows*_cols);
+            
+            return _reduction_factor > 1 ? reduce_sample(elem) : add_sample(elem);
+        });
+    }
+    
+    if(!_current_block->commit())
+    {
+        return false;
+    }
+    
+    if(_max_block_age_ms > 0)
+    {
+        check_block_age();
+    }
+    
+    return true;
+}
+
 int VariableBuffer::NumBlocks()
 {
-    return QueueImpl::Size();
+    return QueueImpl::DEFAULT_NUM_BLOCKS;
 }
 
 void XBot::VariableBuffer::set_buffer_mode(VariableBuffer::Mode mode)
 {
     _buffer_mode = mode;
+    
+    // there is no consumer to allocate blocks on demand
+    if(_buffer_mode == Mode::circular_buffer)
+    {
+        preallocate();
+    }
 }
 
 
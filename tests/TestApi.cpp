@@ -4,8 +4,12 @@
 #include "matlogger2/utils/mat_appender.h"
 #include "matlogger2/mat_data.h"
 
+#include <matio.h>
+
 #include <signal.h>
 #include <chrono>
+#include <thread>
+#include <atomic>
 #include <list>
 #include <map>
 #include <boost/variant.hpp>
@@ -246,6 +250,1686 @@ TEST_F(TestApi, checkTypes)
     
 }
 
+TEST_F(TestApi, checkHandles)
+{
+    auto logger = XBot::MatLogger2::MakeLogger("/tmp/checkHandles_logger.mat");
+    
+    XBot::MatLogger2::VariableHandle invalid_handle;
+    ASSERT_FALSE(invalid_handle);
+    ASSERT_FALSE(logger->add(invalid_handle, 1.0));
+    
+    XBot::MatLogger2::VariableHandle vec_handle;
+    ASSERT_TRUE(logger->create(vec_handle, "a_rather_long_vector_variable_name", 3));
+    ASSERT_TRUE(vec_handle);
+    ASSERT_EQ(vec_handle.get_name(), "a_rather_long_vector_variable_name");
+    ASSERT_FALSE(logger->create(invalid_handle, "a_rather_long_vector_variable_name", 3));
+    ASSERT_FALSE(invalid_handle);
+    
+    ASSERT_FALSE(logger->get_handle("undefined_variable"));
+    
+    const XBot::MatLogger2::VariableName scalar_name("a_rather_long_scalar_variable_name");
+    ASSERT_TRUE(logger->add(scalar_name, 0.0));
+    auto scalar_handle = logger->get_handle(scalar_name);
+    ASSERT_TRUE(scalar_handle);
+    
+    for(int i = 0; i < 100; i++)
+    {
+        ASSERT_TRUE(logger->add(vec_handle, Eigen::Vector3d::Constant(i)));
+        ASSERT_TRUE(logger->add(vec_handle, std::vector<float>(3, i)));
+        ASSERT_TRUE(logger->add(scalar_handle, i + 1));
+        ASSERT_TRUE(logger->add(scalar_name, i + 1));
+        ASSERT_TRUE(logger->add(boost::string_view("a_rather_long_scalar_variable_name"), i + 1));
+    }
+    
+    ASSERT_FALSE(logger->add(vec_handle, Eigen::Vector2d::Zero()));
+    
+    logger.reset();
+    
+    XBot::MatLogger2::Options opt;
+    opt.load_file_from_path = true;
+    logger = XBot::MatLogger2::MakeLogger("/tmp/checkHandles_logger.mat", opt);
+    
+    Eigen::MatrixXd data;
+    int slices = 0;
+    ASSERT_TRUE(logger->readvar("a_rather_long_vector_variable_name", data, slices));
+    ASSERT_EQ(data.rows(), 3);
+    ASSERT_EQ(data.cols(), 200);
+    ASSERT_EQ(data(2, 199), 99);
+    
+    ASSERT_TRUE(logger->readvar("a_rather_long_scalar_variable_name", data, slices));
+    ASSERT_EQ(data.size(), 301);
+}
+
+TEST_F(TestApi, checkNativeTypes)
+{
+    const std::string path = "/tmp/checkNativeTypes_logger.mat";
+    auto logger = XBot::MatLogger2::MakeLogger(path);
+    
+    XBot::MatLogger2::VariableHandle flag_handle;
+    ASSERT_TRUE(logger->create<float>("float_var", 3));
+    ASSERT_TRUE(logger->create<std::int32_t>("int32_var", 2, 2));
+    ASSERT_TRUE(logger->create<std::uint8_t>("uint8_var", 1));
+    ASSERT_TRUE(logger->create<bool>(flag_handle, "logical_var", 1));
+    ASSERT_TRUE(logger->create("double_var", 1));
+    
+    const int n_samples = 2000;
+    
+    for(int i = 0; i < n_samples; i++)
+    {
+        ASSERT_TRUE(logger->add("float_var", Eigen::Vector3f::Constant(0.5f*i)));
+        ASSERT_TRUE(logger->add("int32_var", Eigen::Matrix2i::Constant(-i)));
+        ASSERT_TRUE(logger->add("uint8_var", i % 256));
+        ASSERT_TRUE(logger->add(flag_handle, i % 3 == 0));
+        ASSERT_TRUE(logger->add("double_var", i));
+    }
+    
+    logger.reset();
+    
+    // check that the MAT-file classes match the requested types
+    mat_t * mat = Mat_Open(path.c_str(), MAT_ACC_RDONLY);
+    ASSERT_TRUE(mat);
+    
+    std::map<std::string, matio_classes> expected_classes = {
+        {"float_var",   MAT_C_SINGLE},
+        {"int32_var",   MAT_C_INT32},
+        {"uint8_var",   MAT_C_UINT8},
+        {"logical_var", MAT_C_UINT8},
+        {"double_var",  MAT_C_DOUBLE}
+    };
+    
+    for(const auto& p : expected_classes)
+    {
+        matvar_t * mat_var = Mat_VarReadInfo(mat, p.first.c_str());
+        ASSERT_TRUE(mat_var) << p.first;
+        ASSERT_EQ(mat_var->class_type, p.second) << p.first;
+        ASSERT_EQ(bool(mat_var->isLogical), p.first == "logical_var");
+        Mat_VarFree(mat_var);
+    }
+    
+    Mat_Close(mat);
+    
+    // check data (readvar() converts all numeric types to double)
+    XBot::MatLogger2::Options opt;
+    opt.load_file_from_path = true;
+    logger = XBot::MatLogger2::MakeLogger(path, opt);
+    
+    Eigen::MatrixXd data;
+    int slices = 0;
+    
+    ASSERT_TRUE(logger->readvar("float_var", data, slices));
+    ASSERT_EQ(data.cols(), n_samples);
+    ASSERT_EQ(data(2, n_samples-1), 0.5*(n_samples-1));
+    
+    ASSERT_TRUE(logger->readvar("int32_var", data, slices));
+    ASSERT_EQ(slices, n_samples);
+    ASSERT_EQ(data(1, 2*n_samples-1), -(n_samples-1));
+    
+    ASSERT_TRUE(logger->readvar("uint8_var", data, slices));
+    ASSERT_EQ(data.size(), n_samples);
+    ASSERT_EQ(data(n_samples-1), (n_samples-1) % 256);
+    
+    ASSERT_TRUE(logger->readvar("logical_var", data, slices));
+    ASSERT_EQ(data.size(), n_samples);
+    ASSERT_EQ(data.sum(), (n_samples+2)/3);
+}
+
+TEST_F(TestApi, checkBatch)
+{
+    const std::string path = "/tmp/checkBatch_logger.mat";
+    auto logger = XBot::MatLogger2::MakeLogger(path);
+    
+    // small blocks (200 / 20 = 10 elements), so that batches span multiple blocks
+    XBot::MatLogger2::VariableHandle adc_handle;
+    ASSERT_TRUE(logger->create<float>(adc_handle, "adc_var", 2, 1, 200));
+    ASSERT_TRUE(logger->create("mat_var", 2, 3, 200));
+    
+    const int burst_size = 32;
+    const int n_bursts = 50;
+    
+    Eigen::MatrixXd burst(2, burst_size);
+    Eigen::MatrixXi mat_burst(6, burst_size);
+    
+    for(int i = 0; i < n_bursts; i++)
+    {
+        for(int j = 0; j < burst_size; j++)
+        {
+            burst.col(j).setConstant(i*burst_size + j);
+            mat_burst.col(j).setConstant(i*burst_size + j);
+        }
+        
+        ASSERT_TRUE(logger->add_batch(adc_handle, burst));
+        ASSERT_TRUE(logger->add_batch("mat_var", mat_burst));
+        
+        logger->flush_available_data();
+    }
+    
+    // single elements can be mixed with batches
+    ASSERT_TRUE(logger->add(adc_handle, Eigen::Vector2d::Constant(n_bursts*burst_size)));
+    
+    // empty batches are allowed, wrong sizes are not
+    ASSERT_TRUE(logger->add_batch(adc_handle, Eigen::MatrixXd(2, 0)));
+    ASSERT_FALSE(logger->add_batch(adc_handle, Eigen::MatrixXd(3, 10)));
+    
+    // variables are created on first use
+    ASSERT_TRUE(logger->add_batch("new_var", Eigen::MatrixXd::Ones(4, 15)));
+    
+    logger.reset();
+    
+    XBot::MatLogger2::Options opt;
+    opt.load_file_from_path = true;
+    logger = XBot::MatLogger2::MakeLogger(path, opt);
+    
+    Eigen::MatrixXd data;
+    int slices = 0;
+    
+    ASSERT_TRUE(logger->readvar("adc_var", data, slices));
+    ASSERT_EQ(data.rows(), 2);
+    ASSERT_EQ(data.cols(), n_bursts*burst_size + 1);
+    for(int j = 0; j < data.cols(); j++)
+    {
+        ASSERT_EQ(data(1, j), j);
+    }
+    
+    ASSERT_TRUE(logger->readvar("mat_var", data, slices));
+    ASSERT_EQ(slices, n_bursts*burst_size);
+    for(int j = 0; j < slices; j++)
+    {
+        ASSERT_EQ(data(1, 3*j + 2), j);
+    }
+    
+    ASSERT_TRUE(logger->readvar("new_var", data, slices));
+    ASSERT_EQ(data.rows(), 4);
+    ASSERT_EQ(data.cols(), 15);
+}
+
+TEST_F(TestApi, checkReserveCommit)
+{
+    const std::string path = "/tmp/checkReserveCommit_logger.mat";
+    auto logger = XBot::MatLogger2::MakeLogger(path);
+    
+    XBot::MatLogger2::VariableHandle jac_handle, force_handle;
+    ASSERT_TRUE(logger->create(jac_handle, "jacobian", 6, 40, 100));
+    ASSERT_TRUE(logger->create<float>(force_handle, "force", 6, 1, 100));
+    
+    // invalid handle and type mismatch yield an empty view
+    ASSERT_EQ(logger->reserve(XBot::MatLogger2::VariableHandle()).data(), nullptr);
+    ASSERT_EQ(logger->reserve<float>(jac_handle).data(), nullptr);
+    ASSERT_FALSE(logger->commit(XBot::MatLogger2::VariableHandle()));
+    
+    const int n_samples = 1000;
+    
+    for(int i = 0; i < n_samples; i++)
+    {
+        auto J = logger->reserve(jac_handle);
+        ASSERT_NE(J.data(), nullptr);
+        ASSERT_EQ(J.rows(), 6);
+        ASSERT_EQ(J.cols(), 40);
+        J.setConstant(i);
+        J(5, 39) = -i;
+        ASSERT_TRUE(logger->commit(jac_handle));
+        
+        auto f = logger->reserve<float>(force_handle);
+        ASSERT_NE(f.data(), nullptr);
+        f.setConstant(0.5f*i);
+        ASSERT_TRUE(logger->commit(force_handle));
+        
+        logger->flush_available_data();
+    }
+    
+    logger.reset();
+    
+    XBot::MatLogger2::Options opt;
+    opt.load_file_from_path = true;
+    logger = XBot::MatLogger2::MakeLogger(path, opt);
+    
+    Eigen::MatrixXd data;
+    int slices = 0;
+    
+    ASSERT_TRUE(logger->readvar("jacobian", data, slices));
+    ASSERT_EQ(slices, n_samples);
+    for(int i = 0; i < n_samples; i++)
+    {
+        ASSERT_EQ(data(0, 40*i), i);
+        ASSERT_EQ(data(5, 40*i + 39), -i);
+    }
+    
+    ASSERT_TRUE(logger->readvar("force", data, slices));
+    ASSERT_EQ(data.cols(), n_samples);
+    ASSERT_EQ(data(3, n_samples-1), 0.5*(n_samples-1));
+}
+
+TEST_F(TestApi, checkRecord)
+{
+    const std::string path = "/tmp/checkRecord_logger.mat";
+    auto logger = XBot::MatLogger2::MakeLogger(path);
+    
+    XBot::matlogger2::RecordLayout layout;
+    layout.add_field("rec_q", 7)
+          .add_field<float>("rec_tau", 7)
+          .add_field<bool>("rec_flag", 1)
+          .add_field<std::int32_t>("rec_counter", 1)
+          .add_field("rec_rot", 3, 3);
+    
+    // fields are aligned to their scalar size
+    ASSERT_EQ(layout.get_fields()[3].offset % 4, 0);
+    ASSERT_EQ(layout.get_fields()[4].offset % 8, 0);
+    ASSERT_EQ(layout.get_size_bytes() % 8, 0);
+    
+    ASSERT_THROW(XBot::matlogger2::RecordLayout().add_field("x", 0), std::invalid_argument);
+    
+    XBot::MatLogger2::RecordHandle handle;
+    ASSERT_TRUE(logger->create_record(handle, "rec", layout, 1000));
+    ASSERT_TRUE(handle.is_valid());
+    ASSERT_EQ(handle.get_layout().get_num_fields(), 5);
+    
+    // names must be unique among variables
+    XBot::MatLogger2::RecordHandle other_handle;
+    ASSERT_FALSE(logger->create_record(other_handle, "rec", layout));
+    ASSERT_FALSE(other_handle.is_valid());
+    ASSERT_TRUE(logger->create("var", 1));
+    ASSERT_FALSE(logger->create_record(other_handle, "other_rec", 
+                                       XBot::matlogger2::RecordLayout().add_field("var", 1)));
+    
+    // ..including record fields, both by later variables and records
+    ASSERT_FALSE(logger->create("rec_q", 1));
+    ASSERT_FALSE(logger->add("rec_tau", 1.0));
+    ASSERT_FALSE(logger->create_record(other_handle, "other_rec", 
+                                       XBot::matlogger2::RecordLayout().add_field("rec_tau", 7)));
+    
+    // wrong number or size of fields are rejected
+    Eigen::VectorXd q(7);
+    Eigen::VectorXf tau(7);
+    ASSERT_FALSE(logger->add_record(handle, q, tau));
+    ASSERT_FALSE(logger->add_record(handle, q, q.head(3), true, 1, Eigen::Matrix3d::Identity()));
+    ASSERT_FALSE(logger->add_record(XBot::MatLogger2::RecordHandle(), q));
+    
+    const int n_frames = 10000;
+    
+    for(int i = 0; i < n_frames; i++)
+    {
+        q.setConstant(i);
+        tau.setConstant(-0.5f*i);
+        Eigen::Matrix3d rot = Eigen::Matrix3d::Constant(2*i);
+        
+        ASSERT_TRUE(logger->add_record(handle, q, tau, i % 2 == 0, i, rot));
+        
+        if(i % 100 == 0)
+        {
+            logger->flush_available_data();
+        }
+    }
+    
+    logger.reset();
+    
+    XBot::MatLogger2::Options opt;
+    opt.load_file_from_path = true;
+    logger = XBot::MatLogger2::MakeLogger(path, opt);
+    
+    Eigen::MatrixXd data;
+    int slices = 0;
+    
+    ASSERT_TRUE(logger->readvar("rec_q", data, slices));
+    ASSERT_EQ(data.rows(), 7);
+    ASSERT_EQ(data.cols(), n_frames);
+    
+    Eigen::MatrixXd tau_data, flag_data, counter_data, rot_data;
+    ASSERT_TRUE(logger->readvar("rec_tau", tau_data, slices));
+    ASSERT_TRUE(logger->readvar("rec_flag", flag_data, slices));
+    ASSERT_TRUE(logger->readvar("rec_counter", counter_data, slices));
+    ASSERT_TRUE(logger->readvar("rec_rot", rot_data, slices));
+    ASSERT_EQ(slices, n_frames);
+    
+    for(int i = 0; i < n_frames; i++)
+    {
+        ASSERT_EQ(data(6, i), i);
+        ASSERT_EQ(tau_data(6, i), -0.5*i);
+        ASSERT_EQ(flag_data(i), i % 2 == 0 ? 1 : 0);
+        ASSERT_EQ(counter_data(i), i);
+        ASSERT_EQ(rot_data(2, 3*i+2), 2*i);
+    }
+    
+    logger.reset();
+    
+    // check that fields keep their native type
+    mat_t * mat = Mat_Open(path.c_str(), MAT_ACC_RDONLY);
+    ASSERT_TRUE(mat);
+    matvar_t * var = Mat_VarReadInfo(mat, "rec_counter");
+    ASSERT_TRUE(var);
+    EXPECT_EQ(var->class_type, MAT_C_INT32);
+    Mat_VarFree(var);
+    Mat_Close(mat);
+}
+
+TEST_F(TestApi, checkOverflowPolicy)
+{
+    typedef XBot::VariableBuffer::OverflowPolicy Policy;
+    
+    const std::string path = "/tmp/checkOverflowPolicy_logger.mat";
+    
+    XBot::MatLogger2::Options opt;
+    opt.default_overflow_policy = Policy::drop_newest;
+    auto logger = XBot::MatLogger2::MakeLogger(path, opt);
+    
+    // buffers hold 200 samples (20 blocks of 10 samples)
+    const int buffer_size = 200;
+    const int n_samples = 1000;
+    
+    XBot::MatLogger2::VariableHandle newest, oldest, current, backpressure;
+    ASSERT_TRUE(logger->create(newest, "drop_newest", 1, 1, buffer_size));
+    ASSERT_TRUE(logger->create(oldest, "drop_oldest", 1, 1, buffer_size));
+    ASSERT_TRUE(logger->create(current, "drop_current", 1, 1, buffer_size));
+    ASSERT_TRUE(logger->create(backpressure, "backpressure", 1, 1, buffer_size));
+    
+    ASSERT_TRUE(logger->set_overflow_policy(oldest, Policy::drop_oldest));
+    ASSERT_TRUE(logger->set_overflow_policy(current, Policy::drop_current));
+    ASSERT_TRUE(logger->set_overflow_policy(backpressure, Policy::backpressure, 1e6));
+    ASSERT_FALSE(logger->set_overflow_policy(XBot::MatLogger2::VariableHandle(), Policy::drop_oldest));
+    
+    // no consumer: the buffers overflow
+    for(int i = 0; i < n_samples; i++)
+    {
+        ASSERT_EQ(logger->add(newest, i), i < buffer_size);
+        ASSERT_TRUE(logger->add(oldest, i));
+        ASSERT_TRUE(logger->add(current, i));
+    }
+    
+    auto newest_stats = logger->get_drop_stats(newest);
+    EXPECT_EQ(newest_stats.dropped_samples, n_samples - buffer_size);
+    EXPECT_EQ(newest_stats.dropped_blocks, 0);
+    
+    auto oldest_stats = logger->get_drop_stats(oldest);
+    EXPECT_EQ(oldest_stats.dropped_samples, n_samples - buffer_size);
+    EXPECT_EQ(oldest_stats.dropped_blocks, (n_samples - buffer_size)/10);
+    
+    auto current_stats = logger->get_drop_stats(current);
+    EXPECT_GT(current_stats.dropped_samples, 0);
+    
+    // backpressure: the producer waits for the consumer, nothing is lost
+    std::atomic<bool> run(true);
+    std::thread consumer([&logger, &run]()
+    {
+        while(run)
+        {
+            logger->flush_available_data();
+            std::this_thread::yield();
+        }
+    });
+    
+    for(int i = 0; i < 10*n_samples; i++)
+    {
+        ASSERT_TRUE(logger->add(backpressure, i));
+    }
+    
+    run = false;
+    consumer.join();
+    
+    EXPECT_EQ(logger->get_drop_stats(backpressure).dropped_samples, 0);
+    
+    logger.reset();
+    
+    opt.load_file_from_path = true;
+    logger = XBot::MatLogger2::MakeLogger(path, opt);
+    
+    Eigen::MatrixXd data;
+    int slices = 0;
+    
+    // newest samples were lost
+    ASSERT_TRUE(logger->readvar("drop_newest", data, slices));
+    ASSERT_EQ(data.size(), buffer_size);
+    EXPECT_EQ(data(buffer_size-1), buffer_size-1);
+    
+    // oldest samples were lost
+    ASSERT_TRUE(logger->readvar("drop_oldest", data, slices));
+    ASSERT_EQ(data.size(), buffer_size);
+    EXPECT_EQ(data(0), n_samples - buffer_size);
+    EXPECT_EQ(data(buffer_size-1), n_samples - 1);
+    
+    // drop counters account for all missing samples
+    ASSERT_TRUE(logger->readvar("drop_current", data, slices));
+    EXPECT_EQ(data.size() + current_stats.dropped_samples, n_samples);
+    
+    ASSERT_TRUE(logger->readvar("backpressure", data, slices));
+    ASSERT_EQ(data.size(), 10*n_samples);
+    EXPECT_EQ(data(10*n_samples-1), 10*n_samples-1);
+}
+
+TEST_F(TestApi, checkBlockOptions)
+{
+    typedef XBot::VariableBuffer::OverflowPolicy Policy;
+    
+    const std::string path = "/tmp/checkBlockOptions_logger.mat";
+    
+    XBot::MatLogger2::Options opt;
+    opt.default_overflow_policy = Policy::drop_newest;
+    opt.default_num_blocks = 5;
+    auto logger = XBot::MatLogger2::MakeLogger(path, opt);
+    
+    XBot::MatLogger2::VariableHandle few_blocks, many_blocks, default_blocks, invalid;
+    
+    XBot::MatLogger2::VariableOptions var_opt;
+    var_opt.num_blocks = 3;
+    var_opt.block_size = 7;
+    ASSERT_TRUE(logger->create(few_blocks, "few_blocks", 2, 1, var_opt));
+    
+    var_opt.num_blocks = 100;
+    var_opt.block_size = -1;
+    var_opt.buffer_size = 200;
+    ASSERT_TRUE(logger->create<float>(many_blocks, "many_blocks", 2, 1, var_opt));
+    
+    ASSERT_TRUE(logger->create(default_blocks, "default_blocks", 2, 1, 50));
+    
+    var_opt.num_blocks = 0;
+    ASSERT_FALSE(logger->create(invalid, "invalid", 2, 1, var_opt));
+    ASSERT_FALSE(invalid.is_valid());
+    
+    // with no consumer, each buffer accepts num_blocks*block_size samples
+    int accepted[3] = {0, 0, 0};
+    
+    for(int i = 0; i < 1000; i++)
+    {
+        accepted[0] += logger->add(few_blocks, Eigen::Vector2d::Constant(i));
+        accepted[1] += logger->add(many_blocks, Eigen::Vector2d::Constant(i));
+        accepted[2] += logger->add(default_blocks, Eigen::Vector2d::Constant(i));
+    }
+    
+    EXPECT_EQ(accepted[0], 3*7);
+    EXPECT_EQ(accepted[1], 100*2);
+    EXPECT_EQ(accepted[2], 5*10);
+    
+    logger.reset();
+    
+    opt.load_file_from_path = true;
+    logger = XBot::MatLogger2::MakeLogger(path, opt);
+    
+    Eigen::MatrixXd data;
+    int slices = 0;
+    
+    ASSERT_TRUE(logger->readvar("few_blocks", data, slices));
+    ASSERT_EQ(data.cols(), 3*7);
+    EXPECT_EQ(data(1, 3*7-1), 3*7-1);
+    
+    ASSERT_TRUE(logger->readvar("many_blocks", data, slices));
+    ASSERT_EQ(data.cols(), 100*2);
+    EXPECT_EQ(data(1, 100*2-1), 100*2-1);
+}
+
+TEST_F(TestApi, checkBlockView)
+{
+    // 2 blocks of 5 samples
+    XBot::VariableBuffer vbuf("var", 3, 1, 5, XBot::matlogger2::ScalarType::Single, 2);
+    
+    XBot::VariableBuffer::BlockView view;
+    ASSERT_FALSE(vbuf.acquire_block(view));
+    
+    for(int i = 0; i < 7; i++)
+    {
+        ASSERT_TRUE(vbuf.add_elem(Eigen::Vector3d::Constant(i)));
+    }
+    
+    // first block is lent without copying
+    ASSERT_TRUE(vbuf.acquire_block(view));
+    ASSERT_EQ(view.valid_elements, 5);
+    ASSERT_EQ(view.size_bytes, 5*3*sizeof(float));
+    ASSERT_THROW(vbuf.acquire_block(view), std::logic_error);
+    
+    const float * data = reinterpret_cast<const float *>(view.data);
+    for(int i = 0; i < 5; i++)
+    {
+        ASSERT_EQ(data[3*i+2], i);
+    }
+    
+    // the lent block can not be reused by the producer until it is released
+    ASSERT_FALSE(vbuf.flush_to_queue());
+    
+    vbuf.release_block();
+    
+    ASSERT_TRUE(vbuf.flush_to_queue());
+    ASSERT_TRUE(vbuf.acquire_block(view));
+    ASSERT_EQ(view.valid_elements, 2);
+    ASSERT_EQ(reinterpret_cast<const float *>(view.data)[3], 6);
+    vbuf.release_block();
+}
+
+TEST_F(TestApi, checkLazyBlocks)
+{
+    // up to 8 blocks of 5 samples, only two of them are allocated upfront
+    XBot::VariableBuffer vbuf("var", 3, 1, 5, XBot::matlogger2::ScalarType::Double, 8);
+    ASSERT_EQ(vbuf.get_num_blocks(), 8);
+    ASSERT_EQ(vbuf.get_num_allocated_blocks(), 2);
+    
+    double free_space = 1.0;
+    vbuf.set_on_block_available([&free_space](XBot::VariableBuffer::BufferInfo buf_info)
+    {
+        free_space = buf_info.variable_free_space;
+    });
+    
+    // half of the blocks are in use, so more blocks are requested, and 
+    // the consumer is woken up as if the buffer was full..
+    for(int i = 0; i < 6; i++)
+    {
+        ASSERT_TRUE(vbuf.add_elem(Eigen::Vector3d::Constant(i)));
+    }
+    
+    ASSERT_EQ(vbuf.get_num_allocated_blocks(), 2);
+    EXPECT_EQ(free_space, 0.0);
+    
+    // ..which allocates them
+    XBot::VariableBuffer::BlockView view;
+    ASSERT_TRUE(vbuf.acquire_block(view));
+    ASSERT_EQ(view.valid_elements, 5);
+    vbuf.release_block();
+    ASSERT_EQ(vbuf.get_num_allocated_blocks(), 4);
+    
+    vbuf.preallocate(6);
+    ASSERT_EQ(vbuf.get_num_allocated_blocks(), 6);
+    
+    vbuf.preallocate();
+    ASSERT_EQ(vbuf.get_num_allocated_blocks(), 8);
+    
+    // without a consumer, the producer does not allocate blocks, and the
+    // overflow policy applies..
+    XBot::VariableBuffer lonely_vbuf("lonely_var", 1, 1, 5, XBot::matlogger2::ScalarType::Double, 4);
+    ASSERT_FALSE(lonely_vbuf.get_producer_allocation());
+    
+    for(int i = 0; i < 4*5; i++)
+    {
+        ASSERT_TRUE(lonely_vbuf.add_elem(Eigen::Matrix<double, 1, 1>::Constant(i)));
+    }
+    
+    ASSERT_EQ(lonely_vbuf.get_num_allocated_blocks(), 2);
+    ASSERT_GT(lonely_vbuf.get_drop_stats().dropped_samples, 0);
+    
+    // ..unless it is allowed to, as a last resort
+    XBot::VariableBuffer greedy_vbuf("greedy_var", 1, 1, 5, XBot::matlogger2::ScalarType::Double, 4);
+    greedy_vbuf.set_producer_allocation(true);
+    
+    for(int i = 0; i < 4*5; i++)
+    {
+        ASSERT_TRUE(greedy_vbuf.add_elem(Eigen::Matrix<double, 1, 1>::Constant(i)));
+    }
+    
+    ASSERT_EQ(greedy_vbuf.get_num_allocated_blocks(), 4);
+    ASSERT_EQ(greedy_vbuf.get_drop_stats().dropped_samples, 0);
+}
+
+TEST_F(TestApi, checkMaxBlockAge)
+{
+    const std::string path = "/tmp/checkMaxBlockAge_logger.mat";
+    
+    XBot::MatLogger2::Options opt;
+    opt.default_max_block_age_ms = 50;
+    auto logger = XBot::MatLogger2::MakeLogger(path, opt);
+    
+    XBot::MatLogger2::VariableHandle slow, fast;
+    
+    // slow variable would take 1e4 samples to fill a block (the loops 
+    // below add at most 5000 samples)
+    XBot::MatLogger2::VariableOptions var_opt;
+    var_opt.block_size = 1e4;
+    ASSERT_TRUE(logger->create(slow, "slow", 1, 1, var_opt));
+    
+    // no age limit
+    var_opt.max_block_age_ms = 0;
+    ASSERT_TRUE(logger->create(fast, "fast", 1, 1, var_opt));
+    
+    // samples are added (at most every ms, for at most 5 s) until a block 
+    // of the slow variable reaches the consumer
+    const auto timeout = std::chrono::seconds(5);
+    
+    int slow_bytes = 0;
+    int n_samples = 0;
+    
+    for(auto start = std::chrono::steady_clock::now();
+        slow_bytes == 0 && std::chrono::steady_clock::now() < start + timeout; 
+        n_samples++)
+    {
+        logger->add(slow, n_samples);
+        logger->add(fast, n_samples);
+        
+        slow_bytes += logger->flush_available_data();
+        
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    
+    // the stale block of the slow variable reached the consumer before 
+    // being full, whereas no block of the fast variable did
+    EXPECT_GE(slow_bytes, sizeof(double));
+    EXPECT_LT(n_samples, var_opt.block_size);
+    
+    // same with the flusher thread, which periodically wakes up: samples 
+    // are added until the flusher thread has consumed the block holding 
+    // the first one, i.e. until it is no longer in the buffer
+    auto add_until_flushed = [timeout](XBot::MatLogger2& logger, 
+                                       XBot::MatLogger2::VariableHandle handle)
+    {
+        Eigen::MatrixXd data;
+        int n_samples = 0;
+        
+        for(auto start = std::chrono::steady_clock::now();
+            std::chrono::steady_clock::now() < start + timeout; )
+        {
+            logger.add(handle, n_samples++);
+            
+            if(logger.snapshot(handle, data, n_samples) && data.cols() < n_samples)
+            {
+                return true;
+            }
+            
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        
+        return false;
+    };
+    
+    auto appender = XBot::MatAppender::MakeInstance();
+    ASSERT_TRUE(appender->add_logger(logger));
+    appender->start_flush_thread();
+    
+    XBot::MatLogger2::VariableHandle appender_slow;
+    var_opt.max_block_age_ms = -1;
+    ASSERT_TRUE(logger->create(appender_slow, "appender_slow", 1, 1, var_opt));
+    ASSERT_TRUE(add_until_flushed(*logger, appender_slow));
+    
+    appender.reset();
+    
+    // check on-disk data while the logger is still open
+    mat_t * mat = Mat_Open(logger->get_filename().c_str(), MAT_ACC_RDONLY);
+    ASSERT_TRUE(mat);
+    
+    matvar_t * var = Mat_VarReadInfo(mat, "appender_slow");
+    ASSERT_TRUE(var);
+    EXPECT_GE(var->dims[0], 1);
+    Mat_VarFree(var);
+    
+    EXPECT_FALSE(Mat_VarReadInfo(mat, "fast"));
+    
+    Mat_Close(mat);
+    
+    // only the variable has an age limit, and it is created after the 
+    // flusher thread started
+    const std::string var_path = "/tmp/checkMaxBlockAge_var_logger.mat";
+    auto var_logger = XBot::MatLogger2::MakeLogger(var_path);
+    ASSERT_EQ(var_logger->get_min_block_age(), 0);
+    
+    appender = XBot::MatAppender::MakeInstance();
+    ASSERT_TRUE(appender->add_logger(var_logger));
+    appender->start_flush_thread();
+    
+    XBot::MatLogger2::VariableHandle var_slow;
+    var_opt.max_block_age_ms = 50;
+    ASSERT_TRUE(var_logger->create(var_slow, "var_slow", 1, 1, var_opt));
+    EXPECT_EQ(var_logger->get_min_block_age(), 50);
+    ASSERT_TRUE(add_until_flushed(*var_logger, var_slow));
+    
+    appender.reset();
+    
+    mat = Mat_Open(var_logger->get_filename().c_str(), MAT_ACC_RDONLY);
+    ASSERT_TRUE(mat);
+    
+    var = Mat_VarReadInfo(mat, "var_slow");
+    ASSERT_TRUE(var);
+    EXPECT_GE(var->dims[0], 1);
+    Mat_VarFree(var);
+    
+    Mat_Close(mat);
+}
+
+TEST_F(TestApi, checkTrigger)
+{
+    const std::string path = "/tmp/checkTrigger_logger.mat";
+    const std::string capture_path = "/tmp/checkTrigger_logger_trigger_0.mat";
+    std::remove(capture_path.c_str());
+    
+    auto logger = XBot::MatLogger2::MakeLogger(path);
+    
+    // not available in producer-consumer mode
+    ASSERT_FALSE(logger->trigger(0.1, 0.1));
+    
+    logger->set_buffer_mode(XBot::VariableBuffer::Mode::circular_buffer);
+    
+    // ring of 10 blocks of 10 samples
+    XBot::MatLogger2::VariableHandle handle;
+    XBot::MatLogger2::VariableOptions var_opt;
+    var_opt.num_blocks = 10;
+    var_opt.block_size = 10;
+    ASSERT_TRUE(logger->create(handle, "var", 1, 1, var_opt));
+    
+    // trigger after 200 samples, with a window that opens 0.2 s earlier
+    // and closes right away; a pause that is longer than that after 150 
+    // samples ensures that blocks handed off before are out of the window
+    // (samples are then logged as fast as possible)
+    const int n_samples = 300;
+    const int pause_sample = 150;
+    const int trigger_sample = 200;
+    
+    for(int i = 0; i < n_samples; i++)
+    {
+        if(i == pause_sample)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        }
+        
+        logger->add(handle, i);
+        
+        if(i == trigger_sample)
+        {
+            ASSERT_TRUE(logger->trigger(0.2, 0.0));
+            
+            // one capture at a time
+            ASSERT_FALSE(logger->trigger(0.2, 0.0));
+        }
+        
+        // consumer side
+        logger->flush_available_data();
+    }
+    
+    logger.reset();
+    
+    // check captured window
+    XBot::MatLogger2::Options opt;
+    opt.load_file_from_path = true;
+    auto capture = XBot::MatLogger2::MakeLogger(capture_path, opt);
+    
+    Eigen::MatrixXd data;
+    int slices = 0;
+    ASSERT_TRUE(capture->readvar("var", data, slices));
+    ASSERT_GT(data.size(), 0);
+    
+    // samples are contiguous, and span the trigger: from the first block
+    // that was handed off after the pause, to the block that holds the 
+    // trigger sample (which was the first one handed off after the window
+    // closed)
+    for(int i = 1; i < data.size(); i++)
+    {
+        ASSERT_EQ(data(i), data(i-1) + 1);
+    }
+    
+    EXPECT_EQ(data(0), pause_sample - 10);
+    EXPECT_EQ(data(data.size()-1), trigger_sample + 9);
+    
+    // the main file is not affected by the capture: it contains the captured
+    // samples, followed by (at least) the last ring of samples
+    auto main = XBot::MatLogger2::MakeLogger(path, opt);
+    
+    Eigen::MatrixXd main_data;
+    ASSERT_TRUE(main->readvar("var", main_data, slices));
+    
+    for(int i = 1; i < main_data.size(); i++)
+    {
+        ASSERT_GT(main_data(i), main_data(i-1));
+    }
+    
+    for(int i = 0; i < data.size(); i++)
+    {
+        EXPECT_TRUE((main_data.array() == data(i)).any());
+    }
+    
+    for(int i = n_samples - 90; i < n_samples; i++)
+    {
+        EXPECT_TRUE((main_data.array() == i).any());
+    }
+}
+
+TEST_F(TestApi, checkSnapshot)
+{
+    auto logger = XBot::MatLogger2::MakeLogger("/tmp/checkSnapshot_logger.mat");
+    logger->set_buffer_mode(XBot::VariableBuffer::Mode::circular_buffer);
+    
+    // ring of 8 blocks of 16 samples
+    XBot::MatLogger2::VariableHandle handle;
+    XBot::MatLogger2::VariableOptions var_opt;
+    var_opt.num_blocks = 8;
+    var_opt.block_size = 16;
+    ASSERT_TRUE(logger->create(handle, "var", 3, 1, var_opt));
+    
+    Eigen::MatrixXd data;
+    
+    // empty buffer
+    ASSERT_TRUE(logger->snapshot(handle, data, 10));
+    ASSERT_EQ(data.rows(), 3);
+    ASSERT_EQ(data.cols(), 0);
+    
+    ASSERT_FALSE(logger->snapshot(XBot::MatLogger2::VariableHandle(), data, 10));
+    
+    // single thread: most recent samples, oldest first
+    for(int i = 0; i < 100; i++)
+    {
+        logger->add(handle, Eigen::Vector3d::Constant(i));
+    }
+    
+    ASSERT_TRUE(logger->snapshot(handle, data, 50));
+    ASSERT_EQ(data.cols(), 50);
+    ASSERT_EQ(data(0, 0), 50);
+    ASSERT_EQ(data(2, 49), 99);
+    
+    // the ring only holds the 7 blocks before the current one
+    ASSERT_TRUE(logger->snapshot(handle, data, 1000));
+    ASSERT_EQ(data.cols(), 100);
+    
+    // concurrent reader: snapshots are never torn
+    std::atomic<bool> run(true);
+    
+    std::thread producer([&]()
+    {
+        for(int i = 100; run; i++)
+        {
+            logger->add(handle, Eigen::Vector3d::Constant(i));
+        }
+    });
+    
+    int n_consistent = 0;
+    
+    for(int k = 0; k < 1000; k++)
+    {
+        if(!logger->snapshot(handle, data, 64))
+        {
+            continue;
+        }
+        
+        n_consistent++;
+        
+        for(int i = 0; i < data.cols(); i++)
+        {
+            ASSERT_EQ(data(0, i), data(2, i));
+            
+            if(i > 0)
+            {
+                ASSERT_EQ(data(0, i), data(0, i-1) + 1);
+            }
+        }
+    }
+    
+    run = false;
+    producer.join();
+    
+    EXPECT_GT(n_consistent, 0);
+}
+
+TEST_F(TestApi, checkLanes)
+{
+    const std::string path = "/tmp/checkLanes_logger.mat";
+    
+    const int n_threads = 3;
+    const int n_samples = 5000;
+    
+    {
+        // threads log in bursts, faster than the consumer could allocate
+        // blocks on demand
+        XBot::MatLogger2::Options opt;
+        opt.preallocate_blocks = true;
+        auto logger = XBot::MatLogger2::MakeLogger(path, opt);
+        auto appender = XBot::MatAppender::MakeInstance();
+        ASSERT_TRUE(appender->add_logger(logger));
+        appender->start_flush_thread();
+        
+        // the main thread logs as usual
+        XBot::MatLogger2::VariableHandle main_handle;
+        ASSERT_TRUE(logger->create(main_handle, "main_var", 1));
+        
+        std::vector<XBot::MatLogger2::Lane::Ptr> lanes;
+        
+        for(int k = 0; k < n_threads; k++)
+        {
+            lanes.push_back(logger->make_lane());
+        }
+        
+        // names are unique across lanes
+        XBot::MatLogger2::VariableHandle handle;
+        ASSERT_FALSE(lanes[0]->create(handle, "main_var", 1));
+        
+        // lane variables are not visible from the main thread, and vice versa
+        ASSERT_TRUE(lanes[0]->create(handle, "lane_0_handle_var", 2));
+        ASSERT_FALSE(logger->get_handle("lane_0_handle_var"));
+        ASSERT_FALSE(lanes[0]->get_handle("main_var"));
+        
+        // all threads log concurrently
+        std::vector<std::thread> threads;
+        
+        for(int k = 0; k < n_threads; k++)
+        {
+            threads.emplace_back([k, &lanes]()
+            {
+                auto lane = lanes[k];
+                const std::string var_name = "lane_" + std::to_string(k) + "_var";
+                
+                XBot::MatLogger2::VariableHandle lane_handle = lane->get_handle("lane_0_handle_var");
+                
+                for(int i = 0; i < n_samples; i++)
+                {
+                    lane->add(var_name, Eigen::Vector3d::Constant(i));
+                    
+                    if(lane_handle)
+                    {
+                        lane->add(lane_handle, Eigen::Vector2d::Constant(-i));
+                    }
+                    
+                    if(i % 100 == 0)
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+        
+        for(int i = 0; i < n_samples; i++)
+        {
+            logger->add(main_handle, i);
+        }
+        
+        for(auto& t : threads)
+        {
+            t.join();
+        }
+    }
+    
+    // all variables are inside the same file
+    XBot::MatLogger2::Options opt;
+    opt.load_file_from_path = true;
+    auto logger = XBot::MatLogger2::MakeLogger(path, opt);
+    
+    Eigen::MatrixXd data;
+    int slices = 0;
+    
+    ASSERT_TRUE(logger->readvar("main_var", data, slices));
+    ASSERT_EQ(data.size(), n_samples);
+    
+    for(int k = 0; k < n_threads; k++)
+    {
+        ASSERT_TRUE(logger->readvar("lane_" + std::to_string(k) + "_var", data, slices));
+        ASSERT_EQ(data.cols(), n_samples);
+        ASSERT_EQ(data(1, n_samples-1), n_samples-1);
+    }
+    
+    ASSERT_TRUE(logger->readvar("lane_0_handle_var", data, slices));
+    ASSERT_EQ(data.cols(), n_samples);
+    ASSERT_EQ(data(1, n_samples-1), -(n_samples-1));
+}
+
+TEST_F(TestApi, checkReduction)
+{
+    typedef XBot::VariableBuffer::Reduction Reduction;
+    
+    const std::string path = "/tmp/checkReduction_logger.mat";
+    const int n_samples = 100;
+    const int factor = 4;
+    
+    {
+        auto logger = XBot::MatLogger2::MakeLogger(path);
+        
+        std::map<std::string, Reduction> reductions = {
+            {"decimate_var", Reduction::decimate},
+            {"average_var", Reduction::average},
+            {"min_var", Reduction::min},
+            {"max_var", Reduction::max}
+        };
+        
+        XBot::MatLogger2::VariableOptions var_opt;
+        var_opt.reduction_factor = factor;
+        
+        std::vector<XBot::MatLogger2::VariableHandle> handles;
+        
+        for(const auto& p : reductions)
+        {
+            var_opt.reduction = p.second;
+            handles.emplace_back();
+            ASSERT_TRUE(logger->create(handles.back(), p.first, 2, 1, var_opt));
+        }
+        
+        // in-place writes and batches are reduced as well
+        XBot::MatLogger2::VariableHandle reserve_handle, batch_handle;
+        var_opt.reduction = Reduction::average;
+        ASSERT_TRUE(logger->create<float>(reserve_handle, "reserve_var", 1, 1, var_opt));
+        ASSERT_TRUE(logger->create(batch_handle, "batch_var", 1, 1, var_opt));
+        
+        var_opt.reduction_factor = 0;
+        XBot::MatLogger2::VariableHandle invalid;
+        ASSERT_FALSE(logger->create(invalid, "invalid_var", 1, 1, var_opt));
+        
+        Eigen::RowVectorXd batch(n_samples);
+        
+        for(int i = 0; i < n_samples; i++)
+        {
+            for(auto& h : handles)
+            {
+                ASSERT_TRUE(logger->add(h, Eigen::Vector2d(i, -i)));
+            }
+            
+            auto elem = logger->reserve<float>(reserve_handle);
+            ASSERT_EQ(elem.size(), 1);
+            elem(0) = i;
+            ASSERT_TRUE(logger->commit(reserve_handle));
+            
+            batch(i) = i;
+        }
+        
+        ASSERT_TRUE(logger->add_batch(batch_handle, batch));
+    }
+    
+    XBot::MatLogger2::Options opt;
+    opt.load_file_from_path = true;
+    auto logger = XBot::MatLogger2::MakeLogger(path, opt);
+    
+    Eigen::MatrixXd data;
+    int slices = 0;
+    const int n_reduced = n_samples/factor;
+    
+    ASSERT_TRUE(logger->readvar("decimate_var", data, slices));
+    ASSERT_EQ(data.cols(), n_reduced);
+    EXPECT_EQ(data(0, 1), 4);
+    EXPECT_EQ(data(1, n_reduced-1), -96);
+    
+    ASSERT_TRUE(logger->readvar("average_var", data, slices));
+    ASSERT_EQ(data.cols(), n_reduced);
+    EXPECT_EQ(data(0, 0), 1.5);
+    EXPECT_EQ(data(1, 1), -5.5);
+    
+    ASSERT_TRUE(logger->readvar("min_var", data, slices));
+    ASSERT_EQ(data.cols(), n_reduced);
+    EXPECT_EQ(data(0, 1), 4);
+    EXPECT_EQ(data(1, 1), -7);
+    
+    ASSERT_TRUE(logger->readvar("max_var", data, slices));
+    ASSERT_EQ(data.cols(), n_reduced);
+    EXPECT_EQ(data(0, 1), 7);
+    EXPECT_EQ(data(1, 1), -4);
+    
+    ASSERT_TRUE(logger->readvar("reserve_var", data, slices));
+    ASSERT_EQ(data.size(), n_reduced);
+    EXPECT_EQ(data(n_reduced-1), 97.5);
+    
+    ASSERT_TRUE(logger->readvar("batch_var", data, slices));
+    ASSERT_EQ(data.size(), n_reduced);
+    EXPECT_EQ(data(2), 9.5);
+}
+
+TEST_F(TestApi, checkDeadband)
+{
+    const std::string path = "/tmp/checkDeadband_logger.mat";
+    const int n_samples = 100;
+    
+    {
+        auto logger = XBot::MatLogger2::MakeLogger(path);
+        
+        XBot::MatLogger2::VariableOptions var_opt;
+        var_opt.block_size = 3;
+        var_opt.deadband = 0.5;
+        
+        // a step signal with some noise
+        XBot::MatLogger2::VariableHandle step_handle, reserve_handle, batch_handle;
+        ASSERT_TRUE(logger->create(step_handle, "step_var", 2, 1, var_opt));
+        ASSERT_TRUE(logger->create<float>(reserve_handle, "reserve_var", 1, 1, var_opt));
+        ASSERT_TRUE(logger->create(batch_handle, "batch_var", 1, 1, var_opt));
+        
+        // sample indices are saved as a separate variable, whose name is 
+        // reserved (whether it is created before or after)
+        XBot::MatLogger2::VariableHandle invalid;
+        ASSERT_TRUE(logger->create(invalid, "clash_var_idx", 1, 1));
+        ASSERT_FALSE(logger->create(invalid, "clash_var", 1, 1, var_opt));
+        ASSERT_FALSE(logger->create(invalid, "step_var_idx", 1, 1));
+        ASSERT_FALSE(logger->add("batch_var_idx", 1.0));
+        
+        XBot::MatLogger2::RecordHandle rec_handle;
+        ASSERT_FALSE(logger->create_record(rec_handle, "rec", 
+                                           XBot::matlogger2::RecordLayout().add_field("reserve_var_idx", 1)));
+        ASSERT_TRUE(logger->create_record(rec_handle, "rec", 
+                                          XBot::matlogger2::RecordLayout().add_field("field_idx", 1)));
+        ASSERT_FALSE(logger->create(invalid, "field", 1, 1, var_opt));
+        
+        Eigen::RowVectorXd batch(n_samples);
+        
+        for(int i = 0; i < n_samples; i++)
+        {
+            const double value = i/10 + 0.1*(i%2);
+            
+            ASSERT_TRUE(logger->add(step_handle, Eigen::Vector2d(value, 0)));
+            
+            auto elem = logger->reserve<float>(reserve_handle);
+            ASSERT_EQ(elem.size(), 1);
+            elem(0) = value;
+            ASSERT_TRUE(logger->commit(reserve_handle));
+            
+            batch(i) = value;
+        }
+        
+        ASSERT_TRUE(logger->add_batch(batch_handle, batch));
+    }
+    
+    XBot::MatLogger2::Options opt;
+    opt.load_file_from_path = true;
+    auto logger = XBot::MatLogger2::MakeLogger(path, opt);
+    
+    Eigen::MatrixXd data, idx;
+    int slices = 0;
+    
+    for(std::string name : {"step_var", "reserve_var", "batch_var"})
+    {
+        ASSERT_TRUE(logger->readvar(name, data, slices));
+        ASSERT_TRUE(logger->readvar(name + "_idx", idx, slices));
+        ASSERT_EQ(data.cols(), 10);
+        ASSERT_EQ(idx.size(), 10);
+        
+        for(int k = 0; k < 10; k++)
+        {
+            EXPECT_EQ(idx(k), 10*k + 1);
+            EXPECT_NEAR(data(0, k), k, 1e-6);
+        }
+    }
+}
+
+TEST_F(TestApi, checkCreateDuringFlush)
+{
+    const std::string path = "/tmp/checkCreateDuringFlush_logger.mat";
+    const int n_vars = 100;
+    const int n_samples = 1000;
+    
+    {
+        auto logger = XBot::MatLogger2::MakeLogger(path);
+        
+        // a large variable keeps the consumer busy with disk I/O
+        XBot::MatLogger2::VariableOptions var_opt;
+        var_opt.block_size = 10;
+        XBot::MatLogger2::VariableHandle big_handle;
+        ASSERT_TRUE(logger->create(big_handle, "big_var", 10000, 1, var_opt));
+        
+        std::atomic<bool> run(true);
+        
+        std::thread consumer([&logger, &run]()
+        {
+            while(run)
+            {
+                logger->flush_available_data();
+            }
+        });
+        
+        // variables are created (and written) while the consumer 
+        // is flushing the existing ones
+        Eigen::VectorXd big_data = Eigen::VectorXd::Ones(10000);
+        double max_create_time = 0;
+        
+        for(int k = 0; k < n_vars; k++)
+        {
+            const std::string var_name = "new_var_" + std::to_string(k);
+            XBot::MatLogger2::VariableHandle handle;
+            
+            max_create_time = std::max(max_create_time, measure_sec([&](){
+                ASSERT_TRUE(logger->create(handle, var_name, 2, 1));
+            }));
+            
+            for(int i = 0; i < n_samples; i++)
+            {
+                ASSERT_TRUE(logger->add(handle, Eigen::Vector2d(k, i)));
+            }
+            
+            logger->add(big_handle, big_data);
+        }
+        
+        printf("max create() time during flush: %.1f us\n", max_create_time*1e6);
+        
+        run = false;
+        consumer.join();
+    }
+    
+    XBot::MatLogger2::Options opt;
+    opt.load_file_from_path = true;
+    auto logger = XBot::MatLogger2::MakeLogger(path, opt);
+    
+    Eigen::MatrixXd data;
+    int slices = 0;
+    
+    for(int k = 0; k < n_vars; k++)
+    {
+        ASSERT_TRUE(logger->readvar("new_var_" + std::to_string(k), data, slices));
+        ASSERT_EQ(data.cols(), n_samples);
+        EXPECT_EQ(data(0, n_samples-1), k);
+        EXPECT_EQ(data(1, n_samples-1), n_samples-1);
+    }
+}
+
+TEST_F(TestApi, checkCoalescing)
+{
+    const std::string path = "/tmp/checkCoalescing_logger.mat";
+    const int n_samples = 1000;
+    
+    {
+        auto logger = XBot::MatLogger2::MakeLogger(path);
+        
+        // many small blocks are queued before the consumer runs
+        XBot::MatLogger2::VariableOptions var_opt;
+        var_opt.block_size = 7;
+        var_opt.num_blocks = 200;
+        
+        XBot::MatLogger2::VariableHandle vec_handle, mat_handle, idx_handle;
+        ASSERT_TRUE(logger->create(vec_handle, "vec_var", 3, 1, var_opt));
+        ASSERT_TRUE(logger->create<float>(mat_handle, "mat_var", 2, 2, var_opt));
+        var_opt.deadband = 0;
+        ASSERT_TRUE(logger->create(idx_handle, "idx_var", 1, 1, var_opt));
+        
+        for(int i = 0; i < n_samples; i++)
+        {
+            ASSERT_TRUE(logger->add(vec_handle, Eigen::Vector3d(i, -i, 2*i)));
+            ASSERT_TRUE(logger->add(mat_handle, Eigen::Matrix2f::Constant(i)));
+            ASSERT_TRUE(logger->add(idx_handle, i/2));
+        }
+        
+        // all queued blocks are written at once
+        const int queued_samples = n_samples - n_samples%7;
+        const int expected_bytes = queued_samples*3*sizeof(double) + 
+                                   queued_samples*4*sizeof(float) + 
+                                   (n_samples/2 - (n_samples/2)%7)*(sizeof(double) + sizeof(std::int64_t));
+        
+        EXPECT_EQ(logger->flush_available_data(), expected_bytes);
+        EXPECT_EQ(logger->flush_available_data(), 0);
+    }
+    
+    XBot::MatLogger2::Options opt;
+    opt.load_file_from_path = true;
+    auto logger = XBot::MatLogger2::MakeLogger(path, opt);
+    
+    Eigen::MatrixXd data;
+    int slices = 0;
+    
+    ASSERT_TRUE(logger->readvar("vec_var", data, slices));
+    ASSERT_EQ(data.cols(), n_samples);
+    
+    for(int i = 0; i < n_samples; i++)
+    {
+        ASSERT_EQ(data.col(i), Eigen::Vector3d(i, -i, 2*i));
+    }
+    
+    ASSERT_TRUE(logger->readvar("mat_var", data, slices));
+    ASSERT_EQ(slices, n_samples);
+    EXPECT_EQ(data(1, 2*(n_samples-1) + 1), n_samples-1);
+    
+    ASSERT_TRUE(logger->readvar("idx_var_idx", data, slices));
+    ASSERT_EQ(data.size(), n_samples/2);
+    
+    for(int i = 0; i < n_samples/2; i++)
+    {
+        ASSERT_EQ(data(i), 2*i + 1);
+    }
+}
+
+TEST_F(TestApi, checkWorkers)
+{
+    const int n_loggers = 6;
+    const int n_samples = 20000;
+    
+    auto path = [](int k){ return "/tmp/checkWorkers_logger_" + std::to_string(k) + ".mat"; };
+    
+    {
+        auto appender = XBot::MatAppender::MakeInstance();
+        ASSERT_FALSE(appender->set_num_workers(0));
+        ASSERT_TRUE(appender->set_num_workers(3));
+        
+        std::vector<XBot::MatLogger2::Ptr> loggers;
+        std::vector<XBot::MatLogger2::VariableHandle> handles(n_loggers);
+        
+        XBot::MatLogger2::VariableOptions var_opt;
+        var_opt.block_size = 100;
+        var_opt.num_blocks = 100;
+        
+        for(int k = 0; k < n_loggers; k++)
+        {
+            loggers.push_back(XBot::MatLogger2::MakeLogger(path(k)));
+            ASSERT_TRUE(loggers.back()->create(handles[k], "var", 4, 1, var_opt));
+            ASSERT_TRUE(appender->add_logger(loggers.back()));
+            
+            // the producer waits for the workers, so that no sample is lost
+            ASSERT_TRUE(loggers.back()->set_overflow_policy(handles[k], 
+                                                            XBot::VariableBuffer::OverflowPolicy::backpressure, 
+                                                            1e6));
+        }
+        
+        appender->set_wakeup_period(1);
+        appender->start_flush_thread();
+        ASSERT_FALSE(appender->set_num_workers(2));
+        
+        for(int i = 0; i < n_samples; i++)
+        {
+            for(int k = 0; k < n_loggers; k++)
+            {
+                ASSERT_TRUE(loggers[k]->add(handles[k], Eigen::Vector4d::Constant(i + k)));
+            }
+        }
+        
+        // a logger that is destroyed while workers are running
+        loggers.pop_back();
+    }
+    
+    XBot::MatLogger2::Options opt;
+    opt.load_file_from_path = true;
+    
+    for(int k = 0; k < n_loggers; k++)
+    {
+        auto logger = XBot::MatLogger2::MakeLogger(path(k), opt);
+        
+        Eigen::MatrixXd data;
+        int slices = 0;
+        ASSERT_TRUE(logger->readvar("var", data, slices));
+        ASSERT_EQ(data.cols(), n_samples);
+        
+        for(int i = 0; i < n_samples; i++)
+        {
+            ASSERT_EQ(data(3, i), i + k);
+        }
+    }
+}
+
+TEST_F(TestApi, checkWriteQueue)
+{
+    const int n_loggers = 3;
+    const int n_samples = 20000;
+    
+    auto path = [](int k){ return "/tmp/checkWriteQueue_logger_" + std::to_string(k) + ".mat"; };
+    
+    {
+        auto appender = XBot::MatAppender::MakeInstance();
+        ASSERT_FALSE(appender->set_write_queue_size(-1));
+        
+        XBot::MatLogger2::Options opt;
+        opt.enable_compression = true;
+        
+        XBot::MatLogger2::VariableOptions var_opt;
+        var_opt.block_size = 100;
+        var_opt.num_blocks = 500;
+        
+        std::vector<XBot::MatLogger2::Ptr> loggers;
+        std::vector<XBot::MatLogger2::VariableHandle> handles(n_loggers);
+        
+        // loggers that are registered both before and after enabling the queue
+        for(int k = 0; k < n_loggers; k++)
+        {
+            if(k == 1)
+            {
+                ASSERT_TRUE(appender->set_write_queue_size(1e5));
+            }
+            
+            loggers.push_back(XBot::MatLogger2::MakeLogger(path(k), opt));
+            ASSERT_TRUE(loggers.back()->create(handles[k], "var", 10, 1, var_opt));
+            ASSERT_TRUE(appender->add_logger(loggers.back()));
+            
+            // the producer waits for the consumer, so that no sample is lost
+            ASSERT_TRUE(loggers.back()->set_overflow_policy(handles[k], 
+                                                            XBot::VariableBuffer::OverflowPolicy::backpressure, 
+                                                            1e6));
+        }
+        
+        ASSERT_TRUE(appender->set_num_workers(2));
+        appender->set_wakeup_period(1);
+        appender->start_flush_thread();
+        ASSERT_FALSE(appender->set_write_queue_size(0));
+        
+        for(int i = 0; i < n_samples; i++)
+        {
+            for(int k = 0; k < n_loggers; k++)
+            {
+                ASSERT_TRUE(loggers[k]->add(handles[k], Eigen::VectorXd::Constant(10, i + k)));
+            }
+        }
+    }
+    
+    XBot::MatLogger2::Options opt;
+    opt.load_file_from_path = true;
+    
+    for(int k = 0; k < n_loggers; k++)
+    {
+        auto logger = XBot::MatLogger2::MakeLogger(path(k), opt);
+        
+        Eigen::MatrixXd data;
+        int slices = 0;
+        ASSERT_TRUE(logger->readvar("var", data, slices));
+        ASSERT_EQ(data.cols(), n_samples);
+        
+        for(int i = 0; i < n_samples; i++)
+        {
+            ASSERT_EQ(data(9, i), i + k);
+        }
+    }
+}
+
+TEST_F(TestApi, checkBoundedFlush)
+{
+    const std::string path = "/tmp/checkBoundedFlush_logger.mat";
+    const int n_blocks = 5;
+    const int block_size = 100;
+    
+    {
+        auto logger = XBot::MatLogger2::MakeLogger(path);
+        
+        XBot::MatLogger2::VariableOptions var_opt;
+        var_opt.block_size = block_size;
+        var_opt.num_blocks = 2*n_blocks;
+        
+        // variables with different block sizes, in bytes
+        XBot::MatLogger2::VariableHandle handles[3];
+        for(int k = 0; k < 3; k++)
+        {
+            ASSERT_TRUE(logger->create(handles[k], "var_" + std::to_string(k), k + 1, 1, var_opt));
+        }
+        
+        // a block is handed off at the first sample that does not fit
+        for(int i = 0; i < n_blocks*block_size + 1; i++)
+        {
+            for(int k = 0; k < 3; k++)
+            {
+                ASSERT_TRUE(logger->add(handles[k], Eigen::VectorXd::Constant(k + 1, i)));
+            }
+        }
+        
+        // the smallest budget writes a single block per call, visiting 
+        // variables round-robin
+        for(int i = 0; i < n_blocks - 1; i++)
+        {
+            for(int k = 0; k < 3; k++)
+            {
+                EXPECT_EQ(logger->flush_available_data(1), block_size*(k + 1)*sizeof(double));
+            }
+        }
+        
+        // an expired deadline still writes one block
+        EXPECT_EQ(logger->flush_available_data(0, 1e-9), block_size*sizeof(double));
+        
+        // a larger budget writes the remaining blocks
+        EXPECT_EQ(logger->flush_available_data(1e6, 10), block_size*(2 + 3)*sizeof(double));
+        EXPECT_EQ(logger->flush_available_data(1), 0);
+    }
+    
+    XBot::MatLogger2::Options opt;
+    opt.load_file_from_path = true;
+    auto logger = XBot::MatLogger2::MakeLogger(path, opt);
+    
+    Eigen::MatrixXd data;
+    int slices = 0;
+    
+    for(int k = 0; k < 3; k++)
+    {
+        ASSERT_TRUE(logger->readvar("var_" + std::to_string(k), data, slices));
+        ASSERT_EQ(data.rows(), k + 1);
+        ASSERT_EQ(data.cols(), n_blocks*block_size + 1);
+        
+        for(int i = 0; i < n_blocks*block_size + 1; i++)
+        {
+            ASSERT_EQ(data(k, i), i);
+        }
+    }
+}
+
+TEST_F(TestApi, checkUrgentFlush)
+{
+    const std::string path = "/tmp/checkUrgentFlush_logger.mat";
+    const int block_size = 10;
+    const int n_slow = 5;
+    const int fast_blocks = 8;
+    
+    auto logger = XBot::MatLogger2::MakeLogger(path);
+    
+    XBot::MatLogger2::VariableOptions var_opt;
+    var_opt.block_size = block_size;
+    var_opt.num_blocks = 10;
+    
+    XBot::MatLogger2::VariableHandle handle;
+    
+    // slow variables are created first, and have a single queued block
+    for(int k = 0; k < n_slow; k++)
+    {
+        ASSERT_TRUE(logger->create(handle, "slow_var_" + std::to_string(k), 1, 1, var_opt));
+        
+        for(int i = 0; i < block_size + 1; i++)
+        {
+            ASSERT_TRUE(logger->add(handle, i));
+        }
+    }
+    
+    // a fast variable is close to overflowing
+    ASSERT_TRUE(logger->create(handle, "fast_var", 2, 1, var_opt));
+    
+    for(int i = 0; i < fast_blocks*block_size + 1; i++)
+    {
+        ASSERT_TRUE(logger->add(handle, Eigen::Vector2d(i, -i)));
+    }
+    
+    // the fast variable is drained first, until its free space matches 
+    // the one of slow variables
+    for(int i = 0; i < fast_blocks - 1; i++)
+    {
+        EXPECT_EQ(logger->flush_available_data(1), block_size*2*sizeof(double));
+    }
+    
+    EXPECT_EQ(logger->flush_available_data(), (n_slow + 2)*block_size*sizeof(double));
+    EXPECT_EQ(logger->flush_available_data(), 0);
+}
+
+TEST_F(TestApi, checkPendingVariables)
+{
+    const std::string path = "/tmp/checkPendingVariables_logger.mat";
+    const int n_vars = 200;
+    const int block_size = 10;
+    
+    auto logger = XBot::MatLogger2::MakeLogger(path);
+    
+    XBot::MatLogger2::VariableOptions var_opt;
+    var_opt.block_size = block_size;
+    
+    std::vector<XBot::MatLogger2::VariableHandle> handles(n_vars);
+    
+    for(int k = 0; k < n_vars; k++)
+    {
+        ASSERT_TRUE(logger->create(handles[k], "var_" + std::to_string(k), 1, 1, var_opt));
+    }
+    
+    // hand off n_blocks blocks of the given variable
+    auto add_blocks = [&](int k, int n_blocks)
+    {
+        for(int i = 0; i < n_blocks*block_size + 1; i++)
+        {
+            ASSERT_TRUE(logger->add(handles[k], i));
+        }
+    };
+    
+    // only variables with pending blocks are flushed (across groups of variables)
+    for(int k : {3, 70, 199})
+    {
+        add_blocks(k, 1);
+    }
+    
+    EXPECT_EQ(logger->flush_available_data(), 3*block_size*sizeof(double));
+    EXPECT_EQ(logger->flush_available_data(), 0);
+    
+    // a variable that is left with queued blocks is visited again
+    add_blocks(130, 3);
+    
+    for(int i = 0; i < 3; i++)
+    {
+        EXPECT_EQ(logger->flush_available_data(1), block_size*sizeof(double));
+    }
+    
+    EXPECT_EQ(logger->flush_available_data(1), 0);
+}
+
+TEST_F(TestApi, checkCompressionThreads)
+{
+    const int n_samples = 10000;
+    
+    // files written with and without compression threads must hold the same data
+    for(int threads : {0, 4})
+    {
+        const std::string path = "/tmp/checkCompressionThreads_" + std::to_string(threads) + "_logger.mat";
+        
+        {
+            XBot::MatLogger2::Options opt;
+            opt.enable_compression = true;
+            opt.compression_threads = threads;
+            auto logger = XBot::MatLogger2::MakeLogger(path, opt);
+            
+            // appends span several chunks, and start/end in the middle of one
+            XBot::MatLogger2::VariableOptions var_opt;
+            var_opt.block_size = 333;
+            var_opt.num_blocks = 20;
+            
+            XBot::MatLogger2::VariableHandle scalar_handle, vec_handle, mat_handle;
+            ASSERT_TRUE(logger->create(scalar_handle, "scalar_var", 1, 1, var_opt));
+            ASSERT_TRUE(logger->create(vec_handle, "vec_var", 7, 1, var_opt));
+            ASSERT_TRUE(logger->create<float>(mat_handle, "mat_var", 3, 5, var_opt));
+            
+            for(int i = 0; i < n_samples; i++)
+            {
+                Eigen::Matrix<double, 7, 1> vec;
+                vec.setLinSpaced(i, i + 6);
+                
+                Eigen::Matrix<float, 3, 5> mat;
+                mat.setConstant(i);
+                mat(2, 4) = -i;
+                
+                ASSERT_TRUE(logger->add(scalar_handle, i));
+                ASSERT_TRUE(logger->add(vec_handle, vec));
+                ASSERT_TRUE(logger->add(mat_handle, mat));
+                
+                if(i % 2000 == 1999)
+                {
+                    logger->flush_available_data();
+                }
+            }
+        }
+        
+        XBot::MatLogger2::Options opt;
+        opt.load_file_from_path = true;
+        auto logger = XBot::MatLogger2::MakeLogger(path, opt);
+        
+        Eigen::MatrixXd data;
+        int slices = 0;
+        
+        ASSERT_TRUE(logger->readvar("scalar_var", data, slices));
+        ASSERT_EQ(data.size(), n_samples);
+        
+        for(int i = 0; i < n_samples; i++)
+        {
+            ASSERT_EQ(data(i), i);
+        }
+        
+        ASSERT_TRUE(logger->readvar("vec_var", data, slices));
+        ASSERT_EQ(data.rows(), 7);
+        ASSERT_EQ(data.cols(), n_samples);
+        
+        for(int i = 0; i < n_samples; i++)
+        {
+            for(int k = 0; k < 7; k++)
+            {
+                ASSERT_EQ(data(k, i), i + k);
+            }
+        }
+        
+        ASSERT_TRUE(logger->readvar("mat_var", data, slices));
+        ASSERT_EQ(data.rows(), 3);
+        ASSERT_EQ(slices, n_samples);
+        
+        for(int i = 0; i < n_samples; i++)
+        {
+            ASSERT_EQ(data(0, 5*i), i);
+            ASSERT_EQ(data(2, 5*i + 4), -i);
+        }
+    }
+}
+
 TEST_F(TestApi, checkMassiveDump)
 {
     XBot::MatLogger2::Options opt;